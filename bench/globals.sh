@@ -0,0 +1,14 @@
+#!/bin/bash
+# Times 200,000 calls that each read one global, with N globals defined.
+# Run from the top of the repository: bench/globals.sh N [lispy options]
+
+n=${1:-5000}
+shift
+f=$(mktemp)
+
+for ((i = 0; i < n; i++)); do echo "(def {g$i} $i)"; done > "$f"
+echo '(def {f} (\ {n} {if (== n 0) {0} {f (- g0 (- 1 n))}}))' >> "$f"
+echo '(f 200000)' >> "$f"
+
+time ./lispy "$@" "$f"
+rm -f "$f"
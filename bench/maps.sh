@@ -0,0 +1,34 @@
+#!/bin/bash
+# Microseconds per assoc and per get on maps of 1,000 to 1,000,000 integer keys.
+# assoc is timed building maps of that size until a million keys have gone in, less the same
+# loops without the assoc. get is timed over a million lookups, less the same loop without the get.
+# Each time is the least of three runs.
+# Run from the top of the repository: bench/maps.sh [lispy options]
+
+f=$(mktemp)
+opts=("$@")
+
+# least user seconds of three runs of the expressions given
+run() {
+    local TIMEFORMAT=%U
+    printf '%s\n' '(load "library.lspy")' "$@" > "$f"
+    for i in 1 2 3; do { time ./lispy "${opts[@]}" "$f" > /dev/null; } 2>&1; done | sort -n | head -1
+}
+
+printf "%8s %8s %8s\n" keys assoc get
+for n in 1000 10000 100000 1000000; do
+    build="(def {build} (\\ {i n m} {if (== i n) {m} {build (+ i 1) n (assoc (* i 7) i m)}}))"
+    empty="(def {build} (\\ {i n m} {if (== i n) {m} {build (+ i 1) n m}}))"
+    rep="(def {rep} (\\ {r} {if (== r 1) {build 0 $n (map-new {})} {do (build 0 $n (map-new {})) (rep (- r 1))}}))"
+    make="(def {m} (rep $((1000000 / n))))"
+    look="(def {look} (\\ {i c} {if (== i 0) {c} {look (- i 1) (+ c (get (* 7 (% (* i 7919) $n)) m))}}))"
+    nolook="(def {look} (\\ {i c} {if (== i 0) {c} {look (- i 1) (+ c (* 7 (% (* i 7919) $n)))}}))"
+
+    t_empty=$(run "$empty" "$rep" "$make")
+    t_build=$(run "$build" "$rep" "$make")
+    t_nolook=$(run "$build" "$rep" "(def {m} (rep 1))" "$nolook" "(look 1000000 0)")
+    t_look=$(run "$build" "$rep" "(def {m} (rep 1))" "$look" "(look 1000000 0)")
+
+    awk "BEGIN { printf \"%8d %8.2f %8.2f\n\", $n, $t_build - $t_empty, $t_look - $t_nolook }"
+done
+rm -f "$f"
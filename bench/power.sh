@@ -0,0 +1,12 @@
+#!/bin/bash
+# Times (% (^ 3 E) 1000000007), the power of a small base into a large bignum.
+# Run from the top of the repository: bench/power.sh E [lispy options]
+
+e=${1:-100000}
+shift
+f=$(mktemp)
+
+echo "(print (% (^ 3 $e) 1000000007))" > "$f"
+
+time ./lispy "$@" "$f"
+rm -f "$f"
@@ -0,0 +1,31 @@
+#!/bin/bash
+# Seconds the prelude's list functions take over lists of 10,240, 163,840 and 1,310,720 numbers.
+# Each is the time of a script that builds the list and calls the function, less that of one that
+# only builds it. Runs over 60 seconds are stopped and shown as >60.
+# Run from the top of the repository: bench/prelude.sh [lispy options], e.g. --prelude=lispy
+
+f=$(mktemp)
+ops=("len xs" "sum xs" "foldl + 0 xs" "map (\\ {x} {* x 2}) xs" "filter (\\ {x} {== 0 (% x 3)}) xs" "reverse xs" "last xs")
+
+# user seconds to run "$f", or nothing when it was stopped
+run() {
+    local TIMEFORMAT=%U t
+    t=$( { time timeout 60 ./lispy "$@" "$f" > /dev/null; } 2>&1 ) && echo "$t"
+}
+
+printf "%9s %7s %7s %7s %7s %7s %7s %7s\n" n len sum foldl map filter reverse last
+for k in 10 14 17; do
+    base='(load "library.lspy") (def {xs} {0 1 2 3 4 5 6 7 8 9})'
+    for ((i = 0; i < k; i++)); do base+=' (def {xs} (join xs xs))'; done
+    echo "$base" > "$f"
+    t0=$(run "$@")
+
+    printf "%9d" $((10 << k))
+    for op in "${ops[@]}"; do
+        echo "$base (def {r} ($op))" > "$f"
+        t=$(run "$@")
+        if [ -n "$t" ]; then awk "BEGIN { d = $t - $t0; printf \" %7.3f\", (d > 0 ? d : 0) }"; else printf " %7s" ">60"; fi
+    done
+    echo
+done
+rm -f "$f"
@@ -1,4 +1,21 @@
 #include "mpc.h"
+#include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stddef.h>
+#include <math.h>
+
+/* Packed vector kernels use the widest registers the compiler targets */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Matrix multiplies may split their rows across threads */
+#ifdef LISPY_THREADS
+#include <pthread.h>
+#endif
 
 // if we are compiling on windows compile these functions
 #ifdef _WIN32
@@ -24,6 +41,7 @@ void add_history(char* unused) {}
 
 #include <editline/readline.h>
 // #include <editline/history.h>
+#include <sys/resource.h>
 #endif
 
 /* Parser Declarations */
@@ -41,46 +59,801 @@ struct lval;
 struct lenv;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
+typedef struct lmap lmap;
+
+/* Evaluation Engines */
+enum { LENGINE_TREE, LENGINE_VM };
+
+/* Engine selected with --engine=vm|tree, the tree walker is the reference */
+int lispy_engine = LENGINE_TREE;
+
+/* Set by --prelude=lispy, library.lspy then defines its own list functions */
+int lispy_prelude = 0;
+
+/* Deepest nesting of lambda calls allowed, set by --max-depth=N */
+long lispy_max_depth = 5000000;
+
+/* Threads a matrix multiply may use, set by --threads=N when built with LISPY_THREADS */
+int lispy_threads = 1;
 
 /* Lisp Value */
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_BIG, LVAL_DBL, LVAL_VEC, LVAL_MAT, LVAL_MAP };
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+/* Elements of a list, shared between copies until one of them changes */
+/* Each list sharing them may see just a window of them, as "tail" does */
+typedef struct {
+    int refs;
+    /* Collection the elements were last traced in */
+    int mark;
+    /* Number of elements there is room for */
+    int cap;
+    /* The elements belonging to the storage, with room left either side */
+    int start;
+    int count;
+    lval* items[];
+} lcells;
+
+/* Magnitude and sign of an integer too large for a long */
+typedef struct {
+    int neg;
+    int size;
+    uint32_t d[];
+} lbig;
+
+/* Packed vector of longs or of doubles, shared between copies */
+typedef struct {
+    int refs;
+    int dbl;
+    int count;
+    union {
+        long* i;
+        double* f;
+    };
+} lvec;
+
+/* Row major matrix of doubles, shared between copies */
+typedef struct {
+    int refs;
+    int rows;
+    int cols;
+    double d[];
+} lmat;
+
+/* Node of a persistent hash map, shared between maps until one of them changes */
+struct lmap {
+    int refs;
+    /* Collection the node was last traced in */
+    int mark;
+    /* Keys held in this node and the nodes below it */
+    int size;
+    /* Slots of the 32 holding a key and its value, and those holding a node below */
+    /* Nodes past the last bits of hash hold keys whose hashes all match, setting neither */
+    uint32_t pairs;
+    uint32_t nodes;
+    /* Keys and values held here, alternating, then the nodes below in the same block */
+    int count;
+    lmap** sub;
+    lval* kv[];
+};
+
 /* Declare New lval (lisp value) Struct */
+/* Only the fields of its own type are stored, the rest share one union */
 struct lval {
     int type;
 
-    /* Basic */
-    long num;
-    /* Error and Symbol types have some string data */
-    char* err;
-    char* sym;
-    char* str;
+    /* Managed heap links, the collection this lval was last traced in */
+    /* and its position in the grey stack plus one while it waits there */
+    int mark;
+    int grey;
+    lval* gc_prev;
+    lval* gc_next;
+
+    union {
+        /* Basic, numbers too large to fit in the pointer itself */
+        long num;
+        /* and those too large for a long, never holding one that fits */
+        lbig* big;
+        /* Floats */
+        double dbl;
+        /* Packed vectors and matrices */
+        lvec* vec;
+        lmat* mat;
+        /* Persistent maps, the root node */
+        lmap* map;
+        /* Error and Symbol types have some string data */
+        char* err;
+        char* str;
+
+        /* Symbols also note where a lambda's body found them, see lval_resolve */
+        struct {
+            char* sym;
+            int depth;
+            int slot;
+        };
+
+        /* Function*/
+        struct {
+            lbuiltin builtin;
+            /* Frame of the call being evaluated, NULL for a function value */
+            lenv* env;
+            lval* formals;
+            lval* body;
+            /* Arguments given to a partial application, bound to the first formals */
+            lval* args;
+            /* Compiled body shared between copies of a lambda */
+            lcode* code;
+            /* Bindings a call makes, or -1 when a formal name repeats */
+            int slots;
+        };
+
+        /* Expression */
+        /* Count and Pointer to a list of "lval*" held in "store" */
+        struct {
+            int count;
+            lval** cell;
+            lcells* store;
+        };
+    };
+};
+
+/* Small integers are held in the lval pointer itself, tagged by its low bit */
+/* and never allocated, copied or freed */
+#define LVAL_FIX_MIN (LONG_MIN / 2)
+#define LVAL_FIX_MAX (LONG_MAX / 2)
+#define LVAL_IS_FIX(v) ((uintptr_t)(v) & 1)
 
-    /* Function*/
-    lbuiltin builtin;
-    lenv* env;
-    lval* formals;
-    lval* body;
+// type of an lval, read from the tag for small integers
+int lval_type(lval* v) {
+    return LVAL_IS_FIX(v) ? LVAL_NUM : v->type;
+}
+
+// whether "v" is a number of any kind
+int lval_is_number(lval* v) {
+    return LVAL_IS_FIX(v) || v->type == LVAL_NUM || v->type == LVAL_BIG || v->type == LVAL_DBL;
+}
+
+// value of a number lval, held either in the pointer or in the lval
+long lval_int(lval* v) {
+    return LVAL_IS_FIX(v) ? (long)((intptr_t)v >> 1) : v->num;
+}
+
+// whether a number counts as true, which any but zero does
+int lnum_true(lval* v) {
+    switch (lval_type(v)) {
+        case LVAL_DBL: return v->dbl != 0;
+        /* A bignum is never zero */
+        case LVAL_BIG: return 1;
+        default: return lval_int(v) != 0;
+    }
+}
+
+/* Managed Heap */
+
+/* Phases of the tracing collector */
+enum { LGC_IDLE, LGC_MARK, LGC_SWEEP };
+
+/* Collections start once this many lvals are live and the heap has doubled */
+#define LGC_MIN_HEAP 100000
+
+// collector state, every live lval is linked into "nodes"
+struct {
+    int phase;
+    int epoch;
+    lval* nodes;
+    lval* sweep;
+    long live;
+    long threshold;
+
+    /* Microseconds a step may take, 0 runs each collection to completion */
+    long budget;
+    /* Evaluations in progress, the collector only runs between them */
+    int busy;
+
+    /* Traced lvals whose contents still have to be traced */
+    int grey_count;
+    int grey_cap;
+    lval** grey;
+
+    /* Values held outside the global environment at safe points */
+    int nroots;
+    lval** roots;
+
+    /* Statistics */
+    long collections;
+    long freed;
+    long pause_total;
+    long pause_max;
+} lgc;
+
+/* Allocator */
+
+/* lvals are carved out of slabs of this many and recycled through a free list */
+#define LSLAB_LVALS 1024
+
+/* Cell arrays hold a power of two elements, those up to 2^(LSLAB_CLASSES-1) are recycled */
+#define LSLAB_CLASSES 16
+
+/* Building with -DLISPY_MALLOC gives every lval, cell array and environment its own malloc */
+/* so ASan and valgrind can check them individually */
+
+// free lists, a free lval links on through gc_next and a free cell array through items[0]
+struct {
+    lval* lvals;
+    lcells* cells[LSLAB_CLASSES];
+} lslab;
+
+// memory for one lval
+lval* lslab_lval(void) {
+#ifdef LISPY_MALLOC
+    return malloc(sizeof(lval));
+#else
+    if (!lslab.lvals) {
+        lval* slab = malloc(sizeof(lval) * LSLAB_LVALS);
+        for (int i = 0; i < LSLAB_LVALS; i++) {
+            slab[i].gc_next = lslab.lvals;
+            lslab.lvals = &slab[i];
+        }
+    }
+    lval* v = lslab.lvals;
+    lslab.lvals = v->gc_next;
+    return v;
+#endif
+}
+
+void lslab_lval_free(lval* v) {
+#ifdef LISPY_MALLOC
+    free(v);
+#else
+    v->gc_next = lslab.lvals;
+    lslab.lvals = v;
+#endif
+}
+
+// size class of a cell array with room for "count" elements
+int lcells_class(int count) {
+    int k = 0;
+    while ((1 << k) < count) { k++; }
+    return k;
+}
+
+// empty cell array with room for at least "count" elements, used by one list
+lcells* lcells_new(int count) {
+    lcells* s;
+#ifdef LISPY_MALLOC
+    s = malloc(sizeof(lcells) + sizeof(lval*) * count);
+    s->cap = count;
+#else
+    int k = lcells_class(count);
+    if (k < LSLAB_CLASSES && lslab.cells[k]) {
+        s = lslab.cells[k];
+        lslab.cells[k] = (lcells*)s->items[0];
+    } else {
+        s = malloc(sizeof(lcells) + sizeof(lval*) * (1 << k));
+    }
+    s->cap = 1 << k;
+#endif
+    s->refs = 1;
+    s->mark = lgc.epoch;
+    s->start = 0;
+    s->count = 0;
+    return s;
+}
+
+void lcells_del(lcells* s) {
+#ifdef LISPY_MALLOC
+    free(s);
+#else
+    int k = lcells_class(s->cap);
+    if (k < LSLAB_CLASSES) {
+        s->items[0] = (lval*)lslab.cells[k];
+        lslab.cells[k] = s;
+    } else {
+        free(s);
+    }
+#endif
+}
+
+// allocate an lval on the managed heap, traced if a collection is underway
+lval* lval_alloc(void) {
+    lval* v = lslab_lval();
+    v->mark = lgc.epoch;
+    v->grey = 0;
+    v->gc_prev = NULL;
+    v->gc_next = lgc.nodes;
+    if (lgc.nodes) { lgc.nodes->gc_prev = v; }
+    lgc.nodes = v;
+    lgc.live++;
+    return v;
+}
+
+// return an lval to the heap
+void lval_free(lval* v) {
+
+    /* Take it off the grey stack, moving the last entry into its place */
+    if (v->grey) {
+        lval* last = lgc.grey[--lgc.grey_count];
+        lgc.grey[v->grey-1] = last;
+        last->grey = v->grey;
+    }
+
+    if (lgc.sweep == v) { lgc.sweep = v->gc_next; }
+    if (v->gc_prev) { v->gc_prev->gc_next = v->gc_next; } else { lgc.nodes = v->gc_next; }
+    if (v->gc_next) { v->gc_next->gc_prev = v->gc_prev; }
+    lgc.live--;
+    lslab_lval_free(v);
+}
+
+// queue a traced lval so its contents get traced
+void lgc_grey(lval* v) {
+    if (LVAL_IS_FIX(v) || v->grey) { return; }
+    if (lgc.grey_count == lgc.grey_cap) {
+        lgc.grey_cap = lgc.grey_cap ? lgc.grey_cap * 2 : 256;
+        lgc.grey = realloc(lgc.grey, sizeof(lval*) * lgc.grey_cap);
+    }
+    lgc.grey[lgc.grey_count++] = v;
+    v->grey = lgc.grey_count;
+}
+
+// make sure "v" is traced when it is stored somewhere already traced
+void lgc_shade(lval* v) {
+    if (lgc.phase == LGC_MARK && !LVAL_IS_FIX(v) && v->mark != lgc.epoch) {
+        v->mark = lgc.epoch;
+        lgc_grey(v);
+    }
+}
 
-    /* Expression */
-    /* Count and Pointer to a list of "lval*" */
+/* Symbol Interning */
+
+// an interned name, with how many environments bind it and where the global one is
+typedef struct {
+    int binds;
+    int global;
+    char name[];
+} lsym;
+
+/* The record of an interned name */
+#define LSYM(s) ((lsym*)((s) - offsetof(lsym, name)))
+
+// process-wide open addressing table holding one copy of every symbol name
+struct {
     int count;
-    lval** cell;
-};
+    int cap;
+    char** names;
+} lsyms = { 0, 0, NULL };
+
+// FNV-1a hash of a symbol name
+unsigned long lsym_hash(char* s) {
+    unsigned long h = 2166136261UL;
+    while (*s) { h = (h ^ (unsigned char)*s++) * 16777619UL; }
+    return h;
+}
+
+// find the interned copy of a name, NULL if it was never interned
+char* lsym_find(char* s) {
+    if (lsyms.cap == 0) { return NULL; }
+    unsigned long i = lsym_hash(s) & (lsyms.cap-1);
+    while (lsyms.names[i]) {
+        if (strcmp(lsyms.names[i], s) == 0) { return lsyms.names[i]; }
+        i = (i+1) & (lsyms.cap-1);
+    }
+    return NULL;
+}
+
+// return the interned copy of a name, adding it if needed
+char* lsym_intern(char* s) {
+    char* found = lsym_find(s);
+    if (found) { return found; }
+
+    /* Keep the table at most half full */
+    if ((lsyms.count+1) * 2 > lsyms.cap) {
+        int cap = lsyms.cap ? lsyms.cap * 2 : 256;
+        char** names = calloc(cap, sizeof(char*));
+        for (int j = 0; j < lsyms.cap; j++) {
+            if (!lsyms.names[j]) { continue; }
+            unsigned long i = lsym_hash(lsyms.names[j]) & (cap-1);
+            while (names[i]) { i = (i+1) & (cap-1); }
+            names[i] = lsyms.names[j];
+        }
+        free(lsyms.names);
+        lsyms.names = names;
+        lsyms.cap = cap;
+    }
+
+    unsigned long i = lsym_hash(s) & (lsyms.cap-1);
+    while (lsyms.names[i]) { i = (i+1) & (lsyms.cap-1); }
+    lsym* rec = malloc(sizeof(lsym) + strlen(s) + 1);
+    rec->binds = 0;
+    rec->global = -1;
+    strcpy(rec->name, s);
+    lsyms.names[i] = rec->name;
+    lsyms.count++;
+    return lsyms.names[i];
+}
+
+/* Big Numbers */
+
+/* Magnitudes are held in base 2^32 limbs, least significant first */
+#define LBIG_BASE 4294967296ULL
+
+/* Results are refused beyond this many bits rather than exhausting memory */
+#define LBIG_MAX_BITS (1L << 28)
+
+// empty magnitude with room for "size" limbs, all zero
+lbig* lbig_new(int size) {
+    lbig* b = calloc(1, sizeof(lbig) + sizeof(uint32_t) * (size ? size : 1));
+    b->size = size;
+    return b;
+}
+
+// drop leading zero limbs, zero keeps no limbs and no sign
+lbig* lbig_trim(lbig* b) {
+    while (b->size && b->d[b->size-1] == 0) { b->size--; }
+    if (!b->size) { b->neg = 0; }
+    return b;
+}
+
+lbig* lbig_copy(lbig* b) {
+    lbig* c = lbig_new(b->size);
+    c->neg = b->neg;
+    memcpy(c->d, b->d, sizeof(uint32_t) * b->size);
+    return c;
+}
+
+lbig* lbig_from_long(long x) {
+    lbig* b = lbig_new(2);
+    unsigned long m = x < 0 ? -(unsigned long)x : (unsigned long)x;
+    b->neg = x < 0;
+    b->d[0] = (uint32_t)m;
+    b->d[1] = (uint32_t)((uint64_t)m >> 32);
+    return lbig_trim(b);
+}
+
+// whether "b" fits a long, storing it in "x" when it does
+int lbig_fits(lbig* b, long* x) {
+    if (b->size > 2) { return 0; }
+    uint64_t m = 0;
+    if (b->size > 1) { m = (uint64_t)b->d[1] << 32; }
+    if (b->size > 0) { m |= b->d[0]; }
+    if (b->neg ? m > (uint64_t)LONG_MAX + 1 : m > (uint64_t)LONG_MAX) { return 0; }
+    *x = b->neg ? (long)(0 - m) : (long)m;
+    return 1;
+}
+
+// number of bits in the magnitude of "b"
+long lbig_bits(lbig* b) {
+    if (!b->size) { return 0; }
+    long bits = 32L * (b->size - 1);
+    for (uint32_t top = b->d[b->size-1]; top; top >>= 1) { bits++; }
+    return bits;
+}
+
+// compare magnitudes, -1, 0 or 1
+int lbig_cmp_mag(lbig* a, lbig* b) {
+    if (a->size != b->size) { return a->size < b->size ? -1 : 1; }
+    for (int i = a->size - 1; i >= 0; i--) {
+        if (a->d[i] != b->d[i]) { return a->d[i] < b->d[i] ? -1 : 1; }
+    }
+    return 0;
+}
+
+int lbig_cmp(lbig* a, lbig* b) {
+    if (a->neg != b->neg) { return a->neg ? -1 : 1; }
+    int c = lbig_cmp_mag(a, b);
+    return a->neg ? -c : c;
+}
+
+// a + b, or a - b when "sub" is set
+lbig* lbig_add(lbig* a, lbig* b, int sub) {
+    int bneg = b->neg ^ (sub && b->size);
+
+    /* Same signs add the magnitudes */
+    if (a->neg == bneg) {
+        int n = a->size > b->size ? a->size : b->size;
+        lbig* r = lbig_new(n + 1);
+        uint64_t carry = 0;
+        for (int i = 0; i < n; i++) {
+            carry += (uint64_t)(i < a->size ? a->d[i] : 0) + (i < b->size ? b->d[i] : 0);
+            r->d[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r->d[n] = (uint32_t)carry;
+        r->neg = a->neg;
+        return lbig_trim(r);
+    }
+
+    /* Otherwise the smaller magnitude comes off the larger, which gives the sign */
+    int c = lbig_cmp_mag(a, b);
+    lbig* hi = c >= 0 ? a : b;
+    lbig* lo = c >= 0 ? b : a;
+    lbig* r = lbig_new(hi->size);
+    int64_t borrow = 0;
+    for (int i = 0; i < hi->size; i++) {
+        int64_t t = (int64_t)hi->d[i] - (i < lo->size ? lo->d[i] : 0) - borrow;
+        borrow = t < 0;
+        r->d[i] = (uint32_t)(t + (borrow ? (int64_t)LBIG_BASE : 0));
+    }
+    r->neg = c >= 0 ? a->neg : bneg;
+    return lbig_trim(r);
+}
+
+lbig* lbig_mul(lbig* a, lbig* b) {
+    lbig* r = lbig_new(a->size + b->size);
+    for (int i = 0; i < a->size; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < b->size; j++) {
+            carry += (uint64_t)a->d[i] * b->d[j] + r->d[i+j];
+            r->d[i+j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r->d[i + b->size] = (uint32_t)carry;
+    }
+    r->neg = a->neg != b->neg;
+    return lbig_trim(r);
+}
+
+// divide the magnitude of "b" by "d" in place, returning the remainder
+uint32_t lbig_div_small(lbig* b, uint32_t d) {
+    uint64_t rem = 0;
+    for (int i = b->size - 1; i >= 0; i--) {
+        uint64_t cur = (rem << 32) | b->d[i];
+        b->d[i] = (uint32_t)(cur / d);
+        rem = cur % d;
+    }
+    lbig_trim(b);
+    return (uint32_t)rem;
+}
+
+// quotient of a / b truncated towards zero, and its remainder in "rem", as C does for long
+// "b" must not be zero, long division follows Knuth's Algorithm D
+lbig* lbig_divmod(lbig* a, lbig* b, lbig** rem) {
+    int n = b->size, m = a->size;
+
+    /* A smaller dividend is all remainder */
+    if (lbig_cmp_mag(a, b) < 0) {
+        *rem = lbig_copy(a);
+        return lbig_new(0);
+    }
+
+    lbig* q = lbig_new(m - n + 1);
+    lbig* r;
+
+    if (n == 1) {
+        /* A single limb divisor needs no estimates */
+        lbig* u = lbig_copy(a);
+        uint32_t x = lbig_div_small(u, b->d[0]);
+        memcpy(q->d, u->d, sizeof(uint32_t) * u->size);
+        free(u);
+        r = lbig_new(1);
+        r->d[0] = x;
+    } else {
+        /* Shift both so the top limb of the divisor has its high bit set */
+        int s = 0;
+        while (!(b->d[n-1] & (0x80000000u >> s))) { s++; }
+        uint32_t* vn = malloc(sizeof(uint32_t) * n);
+        uint32_t* un = malloc(sizeof(uint32_t) * (m + 1));
+        for (int i = n - 1; i > 0; i--) {
+            vn[i] = (b->d[i] << s) | (s ? b->d[i-1] >> (32 - s) : 0);
+        }
+        vn[0] = b->d[0] << s;
+        un[m] = s ? a->d[m-1] >> (32 - s) : 0;
+        for (int i = m - 1; i > 0; i--) {
+            un[i] = (a->d[i] << s) | (s ? a->d[i-1] >> (32 - s) : 0);
+        }
+        un[0] = a->d[0] << s;
+
+        for (int j = m - n; j >= 0; j--) {
+
+            /* Estimate the next quotient limb from the top two limbs, at most two too big */
+            uint64_t num = ((uint64_t)un[j+n] << 32) | un[j+n-1];
+            uint64_t qhat = num / vn[n-1];
+            uint64_t rhat = num % vn[n-1];
+            while (qhat >= LBIG_BASE || qhat * vn[n-2] > ((rhat << 32) | un[j+n-2])) {
+                qhat--;
+                rhat += vn[n-1];
+                if (rhat >= LBIG_BASE) { break; }
+            }
+
+            /* Multiply and subtract */
+            int64_t borrow = 0;
+            for (int i = 0; i < n; i++) {
+                uint64_t p = qhat * vn[i];
+                int64_t t = (int64_t)un[i+j] - borrow - (int64_t)(p & 0xFFFFFFFFu);
+                un[i+j] = (uint32_t)t;
+                borrow = (int64_t)(p >> 32) - (t >> 32);
+            }
+            int64_t t = (int64_t)un[j+n] - borrow;
+            un[j+n] = (uint32_t)t;
+
+            /* The estimate was one too big, add the divisor back */
+            if (t < 0) {
+                qhat--;
+                uint64_t carry = 0;
+                for (int i = 0; i < n; i++) {
+                    carry += (uint64_t)un[i+j] + vn[i];
+                    un[i+j] = (uint32_t)carry;
+                    carry >>= 32;
+                }
+                un[j+n] += (uint32_t)carry;
+            }
+            q->d[j] = (uint32_t)qhat;
+        }
+
+        /* The remainder is what is left, shifted back */
+        r = lbig_new(n);
+        for (int i = 0; i < n; i++) {
+            r->d[i] = (un[i] >> s) | (s ? un[i+1] << (32 - s) : 0);
+        }
+        free(vn);
+        free(un);
+    }
+
+    q->neg = a->neg != b->neg;
+    r->neg = a->neg;
+    *rem = lbig_trim(r);
+    return lbig_trim(q);
+}
+
+// decimal digits of "b", freed by the caller
+char* lbig_str(lbig* b) {
+
+    /* Nine digits at a time come off the bottom */
+    lbig* t = lbig_copy(b);
+    int chunks = 0;
+    uint32_t* parts = malloc(sizeof(uint32_t) * (t->size * 10 / 9 + 1));
+    while (t->size) { parts[chunks++] = lbig_div_small(t, 1000000000u); }
+    free(t);
+
+    char* s = malloc(chunks * 9 + 2);
+    char* p = s;
+    if (b->neg) { *p++ = '-'; }
+    p += sprintf(p, "%u", chunks ? parts[chunks-1] : 0);
+    for (int i = chunks - 2; i >= 0; i--) { p += sprintf(p, "%09u", parts[i]); }
+    free(parts);
+    return s;
+}
+
+// read an optionally signed run of decimal digits
+lbig* lbig_read(char* s) {
+    int neg = (*s == '-');
+    if (neg) { s++; }
+
+    /* Each digit multiplies by ten and adds itself */
+    int len = strlen(s);
+    lbig* b = lbig_new(len / 9 + 2);
+    b->size = 0;
+    for (int i = 0; i < len; i++) {
+        uint64_t carry = s[i] - '0';
+        for (int j = 0; j < b->size; j++) {
+            carry += (uint64_t)b->d[j] * 10;
+            b->d[j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry) { b->d[b->size++] = (uint32_t)carry; }
+    }
+    b->neg = neg;
+    return lbig_trim(b);
+}
+
+// nearest double to "b", infinite beyond the range of one
+double lbig_double(lbig* b) {
+    if (!b->size) { return 0; }
+
+    /* The top 64 bits, with the lowest set if any bit below them is, round just once */
+    long shift = lbig_bits(b) > 64 ? lbig_bits(b) - 64 : 0;
+    int w = shift / 32, s = shift % 32;
+    uint64_t lo = b->d[w];
+    uint64_t mid = w + 1 < b->size ? b->d[w+1] : 0;
+    uint64_t hi = w + 2 < b->size ? b->d[w+2] : 0;
+    uint64_t m = (lo >> s) | (mid << (32 - s)) | (s ? hi << (64 - s) : 0);
+    int sticky = (lo & ((1u << s) - 1)) != 0;
+    for (int i = 0; i < w && !sticky; i++) { sticky = b->d[i] != 0; }
+
+    double d = ldexp((double)(m | sticky), shift);
+    return b->neg ? -d : d;
+}
+
+// the whole number "d" exactly, which must be finite
+lbig* lbig_from_double(double d) {
+    int e;
+    uint64_t m = (uint64_t)ldexp(frexp(fabs(d), &e), 53);
+    if (e <= 53) { return lbig_from_long((long)d); }
+
+    /* |d| is the 53 bit "m" shifted up by e - 53 */
+    long shift = e - 53;
+    int w = shift / 32, s = shift % 32;
+    lbig* b = lbig_new(w + 3);
+    b->d[w] = (uint32_t)(m << s);
+    b->d[w+1] = (uint32_t)(m >> (32 - s));
+    b->d[w+2] = (uint32_t)(s ? m >> (64 - s) : 0);
+    b->neg = d < 0;
+    return lbig_trim(b);
+}
 
 /* Construct a pointer to a new Number lval */
 lval* lval_num(long x) {
-    lval* v = malloc(sizeof(lval));
+    if (x >= LVAL_FIX_MIN && x <= LVAL_FIX_MAX) {
+        return (lval*)(((uintptr_t)x << 1) | 1);
+    }
+    lval* v = lval_alloc();
     v->type = LVAL_NUM;
     v->num = x;
     return v;
 }
 
+// number lval taking over "b", a plain number whenever it fits a long
+lval* lval_big(lbig* b) {
+    long x;
+    if (lbig_fits(b, &x)) {
+        free(b);
+        return lval_num(x);
+    }
+    lval* v = lval_alloc();
+    v->type = LVAL_BIG;
+    v->big = b;
+    return v;
+}
+
+/* Construct a pointer to a new Float lval */
+lval* lval_dbl(double x) {
+    lval* v = lval_alloc();
+    v->type = LVAL_DBL;
+    v->dbl = x;
+    return v;
+}
+
+// vector of "count" longs or doubles, its elements left to the caller
+lvec* lvec_new(int dbl, int count) {
+    lvec* x = malloc(sizeof(lvec));
+    x->refs = 1;
+    x->dbl = dbl;
+    x->count = count;
+    /* Room for doubles holds longs too, with one spare so empty vectors own memory as well */
+    x->f = malloc(sizeof(double) * (count + 1));
+    return x;
+}
+
+void lvec_del(lvec* x) {
+    if (--x->refs > 0) { return; }
+    free(x->f);
+    free(x);
+}
+
+// matrix of "rows" by "cols" zeros
+lmat* lmat_new(int rows, int cols) {
+    lmat* m = calloc(1, sizeof(lmat) + sizeof(double) * ((size_t)rows * cols + 1));
+    m->refs = 1;
+    m->rows = rows;
+    m->cols = cols;
+    return m;
+}
+
+void lmat_del(lmat* m) {
+    if (--m->refs > 0) { return; }
+    free(m);
+}
+
+/* Construct a pointer to a new Matrix lval */
+lval* lval_mat(lmat* m) {
+    lval* v = lval_alloc();
+    v->type = LVAL_MAT;
+    v->mat = m;
+    return v;
+}
+
+/* Construct a pointer to a new Vector lval */
+lval* lval_vec(lvec* x) {
+    lval* v = lval_alloc();
+    v->type = LVAL_VEC;
+    v->vec = x;
+    return v;
+}
+
 /* Construct a pointer to a new Error lval */
 lval* lval_err(char* fmt, ...) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_ERR;
 
     /* Create a va list and initialize it */
@@ -102,18 +875,19 @@ lval* lval_err(char* fmt, ...) {
     return v;
 }
 
-/* Construct a pointer to a new Symbol lval */
+/* Construct a pointer to a new Symbol lval, the name is shared through the intern table */
 lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    v->sym = lsym_intern(s);
+    v->depth = 0;
+    v->slot = -1;
     return v;
 }
 
 // function for constructing string lval
 lval* lval_str(char* s) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_STR;
     v->str = malloc(strlen(s) + 1);
     strcpy(v->str, s);
@@ -122,91 +896,165 @@ lval* lval_str(char* s) {
 
 // make a new constructor function for lval_builtin
 lval* lval_builtin(lbuiltin func) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_FUN;
     v->builtin = func;
     return v;
 }
 
 lenv* lenv_new(void);
+lcode* lval_compile_body(lval* body);
 
 // constructor for user defined lval functions
 lval* lval_lambda(lval* formals, lval* body) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_FUN;
 
     /* Set Builtin to Null */
     v->builtin = NULL;
 
-    /* Build new environment */
-    v->env = lenv_new();
+    /* A frame is made for each call */
+    v->env = NULL;
+    v->args = NULL;
 
     /* Set Formals and Body */
     v->formals = formals;
     v->body = body;
+    lgc_shade(formals);
+    lgc_shade(body);
+
+    /* Count the bindings a call makes so its frame can be sized up front */
+    v->slots = 0;
+    for (int i = 0; i < formals->count; i++) {
+        if (strcmp(formals->cell[i]->sym, "&") == 0) { continue; }
+        for (int j = 0; j < i; j++) {
+            if (formals->cell[j]->sym == formals->cell[i]->sym) { v->slots = -1; }
+        }
+        if (v->slots >= 0) { v->slots++; }
+    }
+
+    /* Compile the body once up front so every copy can share it */
+    v->code = NULL;
+    if (lispy_engine == LENGINE_VM) {
+        v->code = lval_compile_body(body);
+    }
     return v;
 }
 
+// view of the formals of "f" not yet given an argument
+lval lval_formals_left(lval* f) {
+    lval rest = *f->formals;
+    int bound = f->args ? f->args->count : 0;
+    rest.cell += bound;
+    rest.count -= bound;
+    return rest;
+}
+
 /* A pointer to a new empty Sexpr lval */
 lval* lval_sexpr(void) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_SEXPR;
     v->count = 0;
     v->cell = NULL;
+    v->store = NULL;
     return v;
 }
 
 /* A pointer to a new empty Qexpr lval */
 lval* lval_qexpr(void) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_QEXPR;
     v->count = 0;
     v->cell = NULL;
+    v->store = NULL;
     return v;
 }
 
 void lenv_del(lenv* e);
+void lcode_del(lcode* c);
+void lmap_del(lmap* n);
+
+/* lvals whose contents are still to be deleted, freeing nested lists takes no C stack */
+struct {
+    int active;
+    int count;
+    int cap;
+    lval** items;
+} ldel;
 
 // function to delete lval*
+// while one deletion runs, lists and lambdas it frees are queued and done by the same loop
 void lval_del(lval* v) {
-    
+
+    /* Small integers own no memory */
+    if (LVAL_IS_FIX(v)) { return; }
+
+    /* Values holding no others are freed at once */
     switch (v->type) {
-        /* Do nothing special for number type or for function pointer type */
-        case LVAL_NUM: break;
-        case LVAL_FUN: 
-            if (!v->builtin) {
-                lenv_del(v->env);
-                lval_del(v->formals);
-                lval_del(v->body);
-            }
-            break;
+        case LVAL_NUM: case LVAL_DBL: case LVAL_SYM: lval_free(v); return;
+        case LVAL_ERR: free(v->err); lval_free(v); return;
+        case LVAL_STR: free(v->str); lval_free(v); return;
+        case LVAL_BIG: free(v->big); lval_free(v); return;
+        case LVAL_VEC: lvec_del(v->vec); lval_free(v); return;
+        case LVAL_MAT: lmat_del(v->mat); lval_free(v); return;
+    }
 
-        /* For Err or Sym or Str free the string data */
-        case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
-        case LVAL_STR: free(v->str); break;
+    if (ldel.active) {
+        if (ldel.count == ldel.cap) {
+            ldel.cap = ldel.cap ? ldel.cap * 2 : 256;
+            ldel.items = realloc(ldel.items, sizeof(lval*) * ldel.cap);
+        }
+        ldel.items[ldel.count++] = v;
+        return;
+    }
 
-        /* If Qexpr or Sexpr then delete all elements inside */
-        case LVAL_QEXPR:
-        case LVAL_SEXPR:
-            for (int i = 0; i < v->count; i++) {
-                lval_del(v->cell[i]);
-            }
-            /* Also free the memory allocated to contain the pointers */
-            free(v->cell);
-            break;
-        
+    ldel.active = 1;
+    while (1) {
+        switch (v->type) {
+            case LVAL_FUN: 
+                if (!v->builtin) {
+                    if (v->env) { lenv_del(v->env); }
+                    if (v->args) { lval_del(v->args); }
+                    lval_del(v->formals);
+                    lval_del(v->body);
+                    if (v->code) { lcode_del(v->code); }
+                }
+                break;
+
+            /* Maps delete their keys and values once no other map shares them */
+            case LVAL_MAP: lmap_del(v->map); break;
+
+            /* If Qexpr or Sexpr then delete all elements once no other list shares them */
+            case LVAL_QEXPR:
+            case LVAL_SEXPR:
+                if (v->store && --v->store->refs == 0) {
+                    for (int i = 0; i < v->store->count; i++) {
+                        lval_del(v->store->items[v->store->start + i]);
+                    }
+                    /* Also free the memory allocated to contain the pointers */
+                    lcells_del(v->store);
+                }
+                break;
+        }
+
+        /* Free the memory allocated for the "lval" struct itself */
+        lval_free(v);
+
+        /* Carry on with whatever was queued */
+        if (!ldel.count) { break; }
+        v = ldel.items[--ldel.count];
     }
-    
-    /* Free the memory allocated for the "lval" struct itself */
-    free(v);
+    ldel.active = 0;
 }
 
-lenv* lenv_copy(lenv* e);
+lcode* lcode_ref(lcode* c);
 
 // function for copying an lval
+// only the lval itself is new, lists and lambdas share their contents with "v"
 lval* lval_copy(lval* v) {
-    lval* x = malloc(sizeof(lval));
+    if (LVAL_IS_FIX(v)) { return v; }
+
+    lval* x = lval_alloc();
     x->type = v->type;
 
     switch (v->type) {
@@ -217,103 +1065,197 @@ lval* lval_copy(lval* v) {
                 x->builtin = v->builtin; 
             } else {
                 x->builtin = NULL;
-                x->env = lenv_copy(v->env);
+                x->env = NULL;
+                x->args = v->args ? lval_copy(v->args) : NULL;
                 x->formals = lval_copy(v->formals);
                 x->body = lval_copy(v->body);
+                x->code = v->code ? lcode_ref(v->code) : NULL;
+                x->slots = v->slots;
             }
             break;
         case LVAL_NUM: x->num = v->num; break;
+        case LVAL_BIG: x->big = lbig_copy(v->big); break;
+        case LVAL_DBL: x->dbl = v->dbl; break;
+        case LVAL_VEC: x->vec = v->vec; x->vec->refs++; break;
+        case LVAL_MAT: x->mat = v->mat; x->mat->refs++; break;
+        case LVAL_MAP: x->map = v->map; x->map->refs++; break;
 
         /* Copy Strings using malloc and strcpy */
         case LVAL_ERR:
             x->err = malloc(strlen(v->err) + 1);
             strcpy(x->err, v->err); break;
 
+        /* Symbols share their interned name */
         case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym); break;
+            x->sym = v->sym;
+            x->depth = v->depth;
+            x->slot = v->slot;
+            break;
 
         case LVAL_STR:
             x->str = malloc(strlen(v->str) + 1);
             strcpy(x->str, v->str); break;
 
-        /* Copy Lists by copying each sub-expression */
+        /* Copy Lists by sharing their elements */
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
-            for (int i = 0; i < x->count; i++) {
-                x->cell[i] = lval_copy(v->cell[i]);
-            }
+            x->cell = v->cell;
+            x->store = v->store;
+            if (x->store) { x->store->refs++; }
             break;
     }
+
+    /* The copy shares contents the collector may not have reached yet */
+    if (lgc.phase == LGC_MARK) { lgc_grey(x); }
     return x;
 }
 
+// make "v" the only list using its elements so they can be changed
+void lval_unshare(lval* v) {
+    if (!v->store) { return; }
+    lcells* s = v->store;
+
+    /* Storage nobody else uses any more keeps just the window "v" sees */
+    if (s->refs == 1) {
+        int start = v->cell - s->items;
+        for (int i = s->start; i < start; i++) { lval_del(s->items[i]); }
+        for (int i = start + v->count; i < s->start + s->count; i++) { lval_del(s->items[i]); }
+        s->start = start;
+        s->count = v->count;
+        return;
+    }
+
+    /* Copy each element into storage of our own */
+    lcells* t = lcells_new(v->count);
+    for (int i = 0; i < v->count; i++) {
+        t->items[i] = lval_copy(v->cell[i]);
+    }
+    t->count = v->count;
+
+    s->refs--;
+    v->store = t;
+    v->cell = t->items;
+}
+
+// make room for "front" more elements before and "back" more after a list that is not shared
+// storage only moves once it is outgrown, doubling in size so adding stays cheap
+void lval_reserve(lval* v, int front, int back) {
+    lcells* s = v->store;
+    if (s && s->start >= front && s->cap - s->start - s->count >= back) { return; }
+
+    /* The end that ran out gets all of the new room */
+    lcells* t = lcells_new((v->count + front + back) * 2);
+    t->start = front ? t->cap - v->count - back : 0;
+    t->count = v->count;
+    if (s) {
+        memcpy(&t->items[t->start], v->cell, sizeof(lval*) * v->count);
+        /* The elements are only moving, they have been traced if "s" was */
+        t->mark = s->mark;
+        lcells_del(s);
+    }
+    v->store = t;
+    v->cell = &t->items[t->start];
+}
+
+// set the number of elements of a list that is not shared, new ones are filled in by the caller
+void lval_resize(lval* v, int count) {
+    if (count > v->count) { lval_reserve(v, 0, count - v->count); }
+    if (!v->store) { return; }
+    v->count = count;
+    v->store->count = count;
+}
+
 lval* lval_add(lval* v, lval* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count-1] = x;
+    lval_unshare(v);
+    lval_reserve(v, 0, 1);
+    v->cell[v->count++] = x;
+    v->store->count++;
+    lgc_shade(x);
     return v;
 }
 
 lval* lval_pop(lval* v, int i) {
+    lval_unshare(v);
+
     /* Find the item at "i" */
     lval* x = v->cell[i];
 
-    /* Shift memory after the item at "i" over the top */
-    memmove(&v->cell[i], &v->cell[i+1], 
-    sizeof(lval*) * (v->count-i-1));
+    if (i == 0) {
+        /* The first item is dropped by moving the start of the window */
+        v->cell++;
+        v->store->start++;
+    } else {
+        /* Shift memory after the item at "i" over the top */
+        memmove(&v->cell[i], &v->cell[i+1], 
+        sizeof(lval*) * (v->count-i-1));
+    }
 
-    /* Decrease the count of items in the list */
+    /* Decrease the count of items */
     v->count--;
-
-    /* Reallocate the memory used */
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+    v->store->count--;
     return x;
 }
 
+// free a list whose elements have all been moved elsewhere
+void lval_del_moved(lval* v) {
+    lval_unshare(v);
+    if (v->store) { lcells_del(v->store); }
+    lval_free(v);
+}
 
 // lval_join
 lval* lval_join(lval* x, lval* y) {
+
+    /* A longer 'y' nobody shares takes the elements of 'x' in front instead */
+    if (y->count > x->count && y->store->refs == 1) {
+        int shared = x->store && x->store->refs > 1;
+        int n = x->count;
+
+        lval_unshare(y);
+        lval_reserve(y, n, 0);
+        y->cell -= n;
+        y->count += n;
+        y->store->start -= n;
+        y->store->count += n;
+        for (int i = 0; i < n; i++) {
+            y->cell[i] = shared ? lval_copy(x->cell[i]) : x->cell[i];
+            lgc_shade(y->cell[i]);
+        }
+
+        /* Delete the empty 'x' and return 'y' */
+        y->type = x->type;
+        if (shared) { lval_del(x); } else { lval_del_moved(x); }
+        return y;
+    }
+
+    /* Elements still shared with another list have to be copied */
+    int shared = y->store && y->store->refs > 1;
+
     /* For each cell in 'y' add it to 'x' */
     for (int i = 0; i < y->count; i++) {
-        x = lval_add(x, y->cell[i]);
+        x = lval_add(x, shared ? lval_copy(y->cell[i]) : y->cell[i]);
     }
 
     /* Delete the empty 'y' and return 'x' */
-    free(y->cell);
-    free(y);  
+    if (shared) { lval_del(y); } else { lval_del_moved(y); }
     return x;
 
 }
 
 
 lval* lval_take(lval* v, int i) {
+    /* Avoid unsharing a list that is about to be deleted */
+    if (v->store && v->store->refs > 1) {
+        lval* x = lval_copy(v->cell[i]);
+        lval_del(v);
+        return x;
+    }
     lval* x = lval_pop(v, i);
     lval_del(v);
     return x;
 }
 
-// forward declare lval_print so it can be used in lval_expr_print before we define it
-void lval_print(lval* v);
-
-// printing expressions
-void lval_expr_print(lval* v, char open, char close) {
-    putchar(open);
-    for (int i = 0; i < v->count; i++) {
-    
-        /* Print Value contained within */
-        lval_print(v->cell[i]);
-
-        /* Don't print trailing space if last element */
-        if (i != (v->count-1)) {
-            putchar(' ');
-        }
-    }
-    putchar(close);
-}
-
 void lval_print_str(lval* v) {
     /* Make a Copy of the string */
     char* escaped = malloc(strlen(v->str)+1);
@@ -326,121 +1268,385 @@ void lval_print_str(lval* v) {
     free(escaped);
 }
 
-void lval_print(lval* v) {
-    switch (v->type) {
-        case LVAL_NUM: printf("%li", v->num); break;
-        case LVAL_ERR: printf("Error: %s", v->err); break;
-        case LVAL_SYM: printf("%s", v->sym); break;
-        case LVAL_FUN: 
-            if (v->builtin) {
-                printf("<builtin>"); 
-            } else {
-                printf("(\\ ");
-                lval_print(v->formals);
-                putchar(' ');
-                lval_print(v->body);
-                putchar(')');
-            }
-            break;
-        case LVAL_STR: lval_print_str(v); break;
-        case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-        case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+// print the fewest digits that read back as the same double
+// with an exponent only below 1e-4 or from 1e16 up, as Python does
+// infinities and NaN have no literal, their names read back as symbols
+void lval_print_dbl(double x) {
+    if (isnan(x)) { printf("nan"); return; }
+    if (isinf(x)) { printf(x > 0 ? "inf" : "-inf"); return; }
+
+    char buf[48];
+    int prec = 1;
+    for (; prec < 17; prec++) {
+        snprintf(buf, sizeof(buf), "%.*e", prec - 1, x);
+        if (strtod(buf, NULL) == x) { break; }
     }
-}
+    snprintf(buf, sizeof(buf), "%.*e", prec - 1, x);
 
-/* Print an "lval" followed by a newline */
-void lval_println(lval* v) { lval_print(v); putchar('\n'); }
-
-// function to get string representation of types
-char* ltype_name(int t) {
-    switch (t) {
-        case LVAL_FUN: return "Function";
-        case LVAL_NUM: return "Number";
-        case LVAL_ERR: return "Error";
-        case LVAL_SYM: return "Symbol";
-        case LVAL_STR: return "String";
-        case LVAL_SEXPR: return "S-Expression";
-        case LVAL_QEXPR: return "Q-Expression";
-        default: return "Unknown";
+    /* The same digits without an exponent, as many after the point as are left over */
+    int exp = atoi(strchr(buf, 'e') + 1);
+    if (exp >= -4 && exp < 16) {
+        int places = prec - 1 - exp;
+        snprintf(buf, sizeof(buf), "%.*f", places > 0 ? places : 0, x);
     }
+
+    /* Whole floats keep a point so they are not read back as integers */
+    printf(strpbrk(buf, ".e") ? "%s" : "%s.0", buf);
 }
 
-/* Lisp environment */
+// print a packed vector between square brackets
+void lval_print_vec(lvec* x) {
+    putchar('[');
+    for (int i = 0; i < x->count; i++) {
+        if (i) { putchar(' '); }
+        if (x->dbl) {
+            lval_print_dbl(x->f[i]);
+        } else {
+            printf("%li", x->i[i]);
+        }
+    }
+    putchar(']');
+}
+
+// print a matrix as a vector of its rows
+void lval_print_mat(lmat* m) {
+    putchar('[');
+    for (int i = 0; i < m->rows; i++) {
+        if (i) { putchar(' '); }
+        putchar('[');
+        for (int j = 0; j < m->cols; j++) {
+            if (j) { putchar(' '); }
+            lval_print_dbl(m->d[(size_t)i * m->cols + j]);
+        }
+        putchar(']');
+    }
+    putchar(']');
+}
+
+void lval_print_map(lmap* n);
+
+// print "v", keeping the lists still being printed in a stack of its own
+void lval_print(lval* v) {
+
+    /* Elements of the open lists, how many are printed and what closes them */
+    int depth = 0, cap = 0;
+    struct { lval** items; int count; int i; char close; }* open = NULL;
+
+    while (1) {
+        lval** items = NULL;
+        int count = 0;
+        char close = 0;
+
+        switch (lval_type(v)) {
+            case LVAL_NUM: printf("%li", lval_int(v)); break;
+            case LVAL_BIG: {
+                char* digits = lbig_str(v->big);
+                printf("%s", digits);
+                free(digits);
+                break;
+            }
+            case LVAL_DBL: lval_print_dbl(v->dbl); break;
+            case LVAL_VEC: lval_print_vec(v->vec); break;
+            case LVAL_MAT: lval_print_mat(v->mat); break;
+            case LVAL_MAP: lval_print_map(v->map); break;
+            case LVAL_ERR: printf("Error: %s", v->err); break;
+            case LVAL_SYM: printf("%s", v->sym); break;
+            case LVAL_FUN: 
+                if (v->builtin) {
+                    printf("<builtin>"); 
+                } else {
+                    /* Formals are symbols, the body is printed as the only element of a frame */
+                    lval rest = lval_formals_left(v);
+                    printf("(\\ ");
+                    lval_print(&rest);
+                    putchar(' ');
+                    items = &v->body; count = 1; close = ')';
+                }
+                break;
+            case LVAL_STR: lval_print_str(v); break;
+            case LVAL_SEXPR: putchar('('); items = v->cell; count = v->count; close = ')'; break;
+            case LVAL_QEXPR: putchar('{'); items = v->cell; count = v->count; close = '}'; break;
+        }
+
+        if (close) {
+            if (depth == cap) {
+                cap = cap ? cap * 2 : 16;
+                open = realloc(open, sizeof(*open) * cap);
+            }
+            open[depth].items = items;
+            open[depth].count = count;
+            open[depth].i = 0;
+            open[depth].close = close;
+            depth++;
+        }
+
+        /* Close the lists that are done, then go on to the next element */
+        while (depth && open[depth-1].i == open[depth-1].count) {
+            putchar(open[--depth].close);
+        }
+        if (!depth) { break; }
+
+        /* Don't print a space before the first element */
+        if (open[depth-1].i) { putchar(' '); }
+        v = open[depth-1].items[open[depth-1].i++];
+    }
+    free(open);
+}
+
+/* Print an "lval" followed by a newline */
+void lval_println(lval* v) { lval_print(v); putchar('\n'); }
+
+// function to get string representation of types
+char* ltype_name(int t) {
+    switch (t) {
+        case LVAL_FUN: return "Function";
+        case LVAL_NUM: return "Number";
+        case LVAL_BIG: return "Bignum";
+        case LVAL_DBL: return "Float";
+        case LVAL_VEC: return "Vector";
+        case LVAL_MAT: return "Matrix";
+        case LVAL_MAP: return "Map";
+        case LVAL_ERR: return "Error";
+        case LVAL_SYM: return "Symbol";
+        case LVAL_STR: return "String";
+        case LVAL_SEXPR: return "S-Expression";
+        case LVAL_QEXPR: return "Q-Expression";
+        default: return "Unknown";
+    }
+}
+
+/* Lisp environment */
+
+/* Environments with more bindings than this get a hash index */
+#define LENV_INDEX_MIN 8
+
+/* Enclosing environments searched by lval_resolve, beyond them names are looked up */
+#define LENV_RESOLVE_DEPTH 8
+
+/* Environments with room for up to this many bindings are recycled, as calls make lots */
+#define LENV_POOL 16
 
 // define lenv struct
 struct lenv {
+    /* A frame belongs to the call running in it, the global environment to main */
+    int refs;
+    int mark;
     lenv* par;
     int count;
+    /* Bindings in the order they were made, names are interned */
+    int room;
     char** syms;
     lval** vals;
+    /* Leading bindings borrowed from the partial application being called */
+    int lent;
+    /* Open addressing index into the bindings, -1 marks an empty slot */
+    int cap;
+    int* index;
 };
 
-// function to create lenv structure
-lenv* lenv_new(void) {
-    lenv* e = malloc(sizeof(lenv));
+/* The global environment, set up by main */
+lenv* lenv_global = NULL;
+
+// free environments by the room they have for bindings, linked through par
+lenv* lenv_pool[LENV_POOL+1];
+
+// environment with room for "n" bindings, calls size their frames this way
+lenv* lenv_frame(int n) {
+    lenv* e;
+#ifdef LISPY_MALLOC
+    e = malloc(sizeof(lenv));
+    e->room = n;
+    e->syms = n ? malloc(sizeof(char*) * n) : NULL;
+    e->vals = n ? malloc(sizeof(lval*) * n) : NULL;
+#else
+    if (n <= LENV_POOL && lenv_pool[n]) {
+        e = lenv_pool[n];
+        lenv_pool[n] = e->par;
+    } else {
+        e = malloc(sizeof(lenv));
+        e->room = n;
+        e->syms = n ? malloc(sizeof(char*) * n) : NULL;
+        e->vals = n ? malloc(sizeof(lval*) * n) : NULL;
+    }
+#endif
+    e->refs = 1;
+    e->mark = lgc.epoch;
     e->par = NULL;
     e->count = 0;
-    e->syms = NULL;
-    e->vals = NULL;
+    e->lent = 0;
+    e->cap = 0;
+    e->index = NULL;
     return e;
 }
 
-// function to delete lenv structure
-void lenv_del(lenv* e) {
-    for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+// function to create lenv structure
+lenv* lenv_new(void) {
+    return lenv_frame(0);
+}
+
+// memory of an environment nothing refers to, its bindings already released
+void lenv_free(lenv* e) {
+    free(e->index);
+#ifndef LISPY_MALLOC
+    if (e->room <= LENV_POOL) {
+        e->par = lenv_pool[e->room];
+        lenv_pool[e->room] = e;
+        return;
     }
+#endif
     free(e->syms);
     free(e->vals);
     free(e);
 }
 
+// function to delete lenv structure once it is no longer shared
+void lenv_del(lenv* e) {
+    if (--e->refs > 0) { return; }
+    for (int i = 0; i < e->count; i++) {
+        LSYM(e->syms[i])->binds--;
+        if (i >= e->lent) { lval_del(e->vals[i]); }
+    }
+    lenv_free(e);
+}
+
+// slot in the index an interned name hashes to
+int lenv_hash(lenv* e, char* sym) {
+    unsigned long h = (unsigned long)sym;
+    h = (h >> 4) * 11400714819323198485UL;
+    return (int)(h >> 32) & (e->cap-1);
+}
+
+// rebuild the index for the current bindings
+void lenv_reindex(lenv* e) {
+    e->cap = e->cap ? e->cap * 2 : LENV_INDEX_MIN * 4;
+    e->index = realloc(e->index, sizeof(int) * e->cap);
+    for (int i = 0; i < e->cap; i++) { e->index[i] = -1; }
+    for (int j = 0; j < e->count; j++) {
+        int i = lenv_hash(e, e->syms[j]);
+        while (e->index[i] >= 0) { i = (i+1) & (e->cap-1); }
+        e->index[i] = j;
+    }
+}
+
+// position of an interned name among the bindings of "e", or -1
+int lenv_find(lenv* e, char* sym) {
+
+    /* Small environments are scanned directly */
+    if (!e->index) {
+        for (int i = 0; i < e->count; i++) {
+            if (e->syms[i] == sym) { return i; }
+        }
+        return -1;
+    }
+
+    int i = lenv_hash(e, sym);
+    while (e->index[i] >= 0) {
+        if (e->syms[e->index[i]] == sym) { return e->index[i]; }
+        i = (i+1) & (e->cap-1);
+    }
+    return -1;
+}
+
 // function to get values from the environment
 lval* lenv_get(lenv* e, lval* k) {
+    lsym* s = LSYM(k->sym);
 
-    /* Iterate over all items in environment */
-    for (int i = 0; i < e->count; i++) {
-        /* Check if the stored string matches the symbol string */
-        /* If it does, return a copy of the value */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
+    /* A name bound nowhere but the global environment can be read straight from it */
+    if (s->binds == 1 && s->global >= 0) {
+        return lval_copy(lenv_global->vals[s->global]);
+    }
+
+    /* Try the slot the name was bound in when its lambda was made */
+    if (k->slot >= 0) {
+        /* Nearer environments still come first, scope is dynamic */
+        for (int d = 0; e && d < k->depth; d++, e = e->par) {
+            int i = lenv_find(e, k->sym);
+            if (i >= 0) { return lval_copy(e->vals[i]); }
+        }
+        if (e && k->slot < e->count && e->syms[k->slot] == k->sym) {
+            return lval_copy(e->vals[k->slot]);
         }
     }
 
-    /* If no symbol check in parent otherwise error */
-    if (e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("Unbound symbol '%s'", k->sym);
+    /* Walk up the parent chain, tail calls can make it long */
+    for (; e; e = e->par) {
+        /* If the symbol is bound here return a copy of the value */
+        int i = lenv_find(e, k->sym);
+        if (i >= 0) { return lval_copy(e->vals[i]); }
     }
+
+    /* If no symbol found error */
+    return lval_err("Unbound symbol '%s'", k->sym);
 }
 
-// function to put values into the environment
-void lenv_put(lenv* e, lval* k, lval* v) {
+// bind a copy of "v" to the interned name "sym" in "e"
+void lenv_bind(lenv* e, char* sym, lval* v) {
 
-    /* Iterate over all items in environment */
+    /* If variable is found delete item at that position */
     /* And replace with variable supplied by user */
-    for (int i = 0; i < e->count; i++) {
-
-        /* If variable is found delete item at that position */
-        /* And replace with variable supplied by user */
-        if (strcmp(e->syms[i], k->sym) == 0) {
+    int i = lenv_find(e, sym);
+    if (i >= 0) {
+        /* Rebinding a borrowed value makes the frame take copies of all it borrowed */
+        /* so lenv_del frees every slot, the new value included */
+        if (i < e->lent) {
+            for (int j = 0; j < e->lent; j++) {
+                if (j != i) { e->vals[j] = lval_copy(e->vals[j]); }
+            }
+            e->lent = 0;
+        } else {
             lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
         }
+        e->vals[i] = lval_copy(v);
+        return;
     }
 
-    /* If no existing entry found allocate space for new entry */
+    /* If no existing entry found make room for a new entry */
+    if (e->count == e->room) {
+        e->room = e->room ? e->room * 2 : 1;
+        e->vals = realloc(e->vals, sizeof(lval*) * e->room);
+        e->syms = realloc(e->syms, sizeof(char*) * e->room);
+    }
     e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
 
-    /* Copy contents of lval and symbol string into new location */
+    /* Copy contents of lval and store the interned symbol */
     e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    e->syms[e->count-1] = sym;
+    LSYM(sym)->binds++;
+    if (e == lenv_global) { LSYM(sym)->global = e->count-1; }
+
+    /* Index the new binding, growing the index when half full */
+    if (e->count > LENV_INDEX_MIN && e->count * 2 > e->cap) {
+        lenv_reindex(e);
+    } else if (e->index) {
+        i = lenv_hash(e, sym);
+        while (e->index[i] >= 0) { i = (i+1) & (e->cap-1); }
+        e->index[i] = e->count-1;
+    }
+}
+
+// function to put values into the environment
+void lenv_put(lenv* e, lval* k, lval* v) {
+    lenv_bind(e, k->sym, v);
+}
+
+// bind "v" itself to "sym" in a call's frame
+// "distinct" says no earlier binding has the name, so it goes in the next slot
+void lenv_move(lenv* e, char* sym, lval* v, int distinct) {
+    if (!distinct) {
+        lenv_bind(e, sym, v);
+        lval_del(v);
+        return;
+    }
+    e->syms[e->count] = sym;
+    e->vals[e->count] = v;
+    e->count++;
+    LSYM(sym)->binds++;
+}
+
+// bind "v" to "sym" in a call's frame without taking it, "v" must outlive the frame
+void lenv_lend(lenv* e, char* sym, lval* v) {
+    lenv_move(e, sym, v, 1);
+    e->lent++;
 }
 
 // function for variable definition in the global environment
@@ -451,26 +1657,78 @@ void lenv_def(lenv* e, lval* k, lval* v) {
     lenv_put(e, k, v);
 }
 
-// function for copying environments
-lenv* lenv_copy(lenv* e) {
-    lenv* n = malloc(sizeof(lenv));
-    n->par = e->par;
-    n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
-    for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+// check if every symbol bound in "p" is also bound in "e"
+int lenv_covers(lenv* e, lenv* p) {
+    for (int i = 0; i < p->count; i++) {
+        if (lenv_find(e, p->syms[i]) < 0) { return 0; }
+    }
+    return 1;
+}
+
+// slot a formal is bound to in a fresh call environment, or -1
+int lenv_slot(lval* formals, char* sym) {
+    int slot = 0;
+    for (int i = 0; i < formals->count; i++) {
+        if (strcmp(formals->cell[i]->sym, "&") == 0) { continue; }
+        if (formals->cell[i]->sym == sym) { return slot; }
+        slot++;
+    }
+    return -1;
+}
+
+// note where symbol "v" is bound for a lambda with "formals" made in "e"
+// formals are in the call environment at depth 0 and enclosing locals are found
+// by how far up from "e" they are, lenv_get checks the guess before using it
+void lval_resolve_sym(lval* v, lval* formals, lenv* e) {
+    v->depth = 0;
+    v->slot = lenv_slot(formals, v->sym);
+    if (v->slot >= 0) { return; }
+
+    /* The global environment is left to lenv_get */
+    for (int d = 1; e->par && d <= LENV_RESOLVE_DEPTH; d++, e = e->par) {
+        int i = lenv_find(e, v->sym);
+        if (i >= 0) {
+            v->depth = d;
+            v->slot = i;
+            return;
+        }
     }
-    return n;
+}
+
+// resolve the symbols of lambda body "body", walking its lists with a stack of their own
+// each list is made the body's own before its symbols are noted, as others may share it
+void lval_resolve(lval* body, lval* formals, lenv* e) {
+    int depth = 0, cap = 16;
+    lval** open = malloc(sizeof(lval*) * cap);
+    open[depth++] = body;
+
+    while (depth) {
+        lval* v = open[--depth];
+        lval_unshare(v);
+        for (int i = 0; i < v->count; i++) {
+            lval* x = v->cell[i];
+            switch (lval_type(x)) {
+                case LVAL_SYM: lval_resolve_sym(x, formals, e); break;
+
+                /* Nested Q-Expressions are data, only S-Expressions are code */
+                case LVAL_SEXPR:
+                    if (depth == cap) {
+                        cap *= 2;
+                        open = realloc(open, sizeof(lval*) * cap);
+                    }
+                    open[depth++] = x;
+                    break;
+            }
+        }
+    }
+    free(open);
 }
 
 
 
 // evaluation
 
-long expo(long x, long y);
+int expo(long x, long y, long* r);
 
 // macro to help with error conditions
 #define LASSERT(args, cond, fmt, ...) \
@@ -481,9 +1739,9 @@ long expo(long x, long y);
     }
 
 #define LASSERT_TYPE(func, args, index, expect) \
-    LASSERT(args, args->cell[index]->type == expect, \
+    LASSERT(args, lval_type(args->cell[index]) == expect, \
         "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
-        func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+        func, index, ltype_name(lval_type(args->cell[index])), ltype_name(expect))
 
 
 #define LASSERT_NUM(func, args, num) \
@@ -491,6 +1749,16 @@ long expo(long x, long y);
         "Function '%s' passed incorrect number of arguments. Got %i, Expected %i.", \
         func, args->count, num)
 
+#define LASSERT_INTEGER(func, args, index) \
+    LASSERT(args, lval_type(args->cell[index]) == LVAL_NUM || lval_type(args->cell[index]) == LVAL_BIG, \
+        "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+        func, index, ltype_name(lval_type(args->cell[index])), ltype_name(LVAL_NUM))
+
+#define LASSERT_NUMBER(func, args, index) \
+    LASSERT(args, lval_is_number(args->cell[index]), \
+        "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+        func, index, ltype_name(lval_type(args->cell[index])), "Number or Float")
+
 #define LASSERT_NOT_EMPTY(func, args, index) \
     LASSERT(args, args->cell[index]->count != 0, \
         "Function '%s' passed {} for argument %i.", func, index)
@@ -514,9 +1782,10 @@ lval* builtin_head(lenv* e, lval* a) {
     /* Otherwise take first argument */
     lval* v = lval_take(a, 0);
 
-    /* Delete all elements that are not head and return */
-    while (v->count > 1) { lval_del(lval_pop(v, 1)); }
-    return v;
+    /* Keep only the first element, leaving any shared elements alone */
+    lval* x = lval_add(lval_qexpr(), lval_copy(v->cell[0]));
+    lval_del(v);
+    return x;
 }
 
 // builtin tail
@@ -531,6 +1800,13 @@ lval* builtin_tail(lenv* e, lval* a) {
     /* Take first argument */
     lval* v = lval_take(a, 0);
 
+    /* A list sharing its elements just looks past the first one */
+    if (v->store->refs > 1) {
+        v->cell++;
+        v->count--;
+        return v;
+    }
+
     /* Delete first element and return */
     lval_del(lval_pop(v, 0));
     return v;
@@ -556,281 +1832,2285 @@ lval* builtin_join(lenv* e, lval* a) {
 }
 
 lval* lval_eval(lenv* e, lval* v);
-
-// builtin eval
-lval* builtin_eval(lenv* e, lval* a) {
-    LASSERT_NUM("eval", a, 1);
-    LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
-
-    lval* x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+lval* lval_apply(lenv* e, lval* f, lval* a);
+/* Operators of the arithmetic and comparison builtins */
+/* Each builtin passes its own to the shared loop, so no names are compared per call */
+enum { LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_MOD, LOP_EXP,
+       LOP_GT, LOP_LT, LOP_GE, LOP_LE, LOP_EQ, LOP_NE };
+
+/* Names of the operators, as given in error messages */
+char* lop_names[] = { "+", "-", "*", "/", "%", "^", ">", "<", ">=", "<=", "==", "!=" };
+
+lval* builtin_op(lenv* e, lval* a, int op);
+int lnum_cmp(lval* x, lval* y);
+double lnum_double(lval* v);
+int lval_eq(lval* x, lval* y);
+lval* lvec_arith(lval* a, int op);
+lval* lvec_ord(lval* a, int op);
+lval* lvec_reduce(lval* a, int op);
+
+/* Native List Functions */
+/* These replace the list functions of library.lspy with single passes over the elements */
+
+// an element as 'fst' gives it, only symbols and expressions need evaluating
+lval* lval_elem(lenv* e, lval* x) {
+    int t = lval_type(x);
+    if (t == LVAL_SYM || t == LVAL_SEXPR) { return lval_eval(e, lval_copy(x)); }
+    return lval_copy(x);
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
+// narrow "v" down to "count" of its elements from "start", sharing their storage
+lval* lval_slice(lval* v, int start, int count) {
+    if (start) { v->cell += start; }
+    v->count = count;
+    return v;
+}
 
-    /* Ensure all arguments are numbers */
-    for (int i = 0; i < a->count; i++) {
-        LASSERT_TYPE(op, a, i, LVAL_NUM);
-    }
+// length of list or vector
+lval* builtin_len(lenv* e, lval* a) {
+    LASSERT_NUM("len", a, 1);
+    if (lval_type(a->cell[0]) != LVAL_VEC) { LASSERT_TYPE("len", a, 0, LVAL_QEXPR); }
 
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
+    lval* l = a->cell[0];
+    lval* x = lval_num(lval_type(l) == LVAL_VEC ? l->vec->count : l->count);
+    lval_del(a);
+    return x;
+}
 
-    /* If no arguments and sub then perform unary negation */
-    if ((strcmp(op, "-") == 0) && a->count == 0) {
-        x->num = -x->num;
+// nth item in a list or vector
+lval* builtin_nth(lenv* e, lval* a) {
+    LASSERT_NUM("nth", a, 2);
+    LASSERT_TYPE("nth", a, 0, LVAL_NUM);
+
+    if (lval_type(a->cell[1]) == LVAL_VEC) {
+        lvec* v = a->cell[1]->vec;
+        long n = lval_int(a->cell[0]);
+        LASSERT(a, n >= 0 && n < v->count,
+            "Function 'nth' passed index %li for a vector of %i elements.", n, v->count);
+        lval* x = v->dbl ? lval_dbl(v->f[n]) : lval_num(v->i[n]);
+        lval_del(a);
+        return x;
     }
+    LASSERT_TYPE("nth", a, 1, LVAL_QEXPR);
 
-    /* While there are still elements remaining */
-    while (a->count > 0) {
+    long n = lval_int(a->cell[0]);
+    LASSERT(a, n >= 0 && n < a->cell[1]->count,
+        "Function 'nth' passed index %li for a list of %i elements.", n, a->cell[1]->count);
 
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
-
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "%") == 0) {
-            if (y->num == 0) {
-                lval_del(x); lval_del(y);
-                x = lval_err("Modulus by Zero--not a number!");
-                break;
-            }
-             x->num %= y->num; 
-        }
-        if (strcmp(op, "^") == 0) { x->num = expo(x->num, y->num); }
-        if (strcmp(op, "/") == 0) {
-            if (y->num == 0) {
-                lval_del(x); lval_del(y);
-                x = lval_err("Division By Zero!");
-                break;
-            }
-            x->num /= y->num;
-        }
+    lval* x = lval_elem(e, a->cell[1]->cell[n]);
+    lval_del(a);
+    return x;
+}
 
-        lval_del(y);
-    }
+// last item in list
+lval* builtin_last(lenv* e, lval* a) {
+    LASSERT_NUM("last", a, 1);
+    LASSERT_TYPE("last", a, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("last", a, 0);
 
+    lval* l = a->cell[0];
+    lval* x = lval_elem(e, l->cell[l->count-1]);
     lval_del(a);
     return x;
 }
 
-// define separate builtins for each of the maths functions
-lval* builtin_add(lenv* e, lval* a) {
-    return builtin_op(e, a, "+");
-}
+// check the arguments of take, drop and split and return the list
+lval* builtin_split_list(lval* a, char* func, long* n) {
+    LASSERT_NUM(func, a, 2);
+    LASSERT_TYPE(func, a, 0, LVAL_NUM);
+    LASSERT_TYPE(func, a, 1, LVAL_QEXPR);
 
-lval* builtin_sub(lenv* e, lval* a) {
-    return builtin_op(e, a, "-");
-}
+    *n = lval_int(a->cell[0]);
+    LASSERT(a, *n >= 0 && *n <= a->cell[1]->count,
+        "Function '%s' passed %li for a list of %i elements.", func, *n, a->cell[1]->count);
 
-lval* builtin_mul(lenv* e, lval* a) {
-    return builtin_op(e, a, "*");
+    return lval_take(a, 1);
 }
 
-lval* builtin_div(lenv* e, lval* a) {
-    return builtin_op(e, a, "/");
+// take n elements
+lval* builtin_take(lenv* e, lval* a) {
+    long n;
+    lval* l = builtin_split_list(a, "take", &n);
+    if (lval_type(l) == LVAL_ERR) { return l; }
+    return lval_slice(l, 0, n);
 }
 
-lval* builtin_mod(lenv* e, lval* a) {
-    return builtin_op(e, a, "%");
+// drop n elements
+lval* builtin_drop(lenv* e, lval* a) {
+    long n;
+    lval* l = builtin_split_list(a, "drop", &n);
+    if (lval_type(l) == LVAL_ERR) { return l; }
+    return lval_slice(l, n, l->count - n);
 }
 
-lval* builtin_exp(lenv* e, lval* a) {
-    return builtin_op(e, a, "^");
+// split at n
+lval* builtin_split(lenv* e, lval* a) {
+    long n;
+    lval* l = builtin_split_list(a, "split", &n);
+    if (lval_type(l) == LVAL_ERR) { return l; }
+
+    lval* x = lval_add(lval_qexpr(), lval_slice(lval_copy(l), 0, n));
+    return lval_add(x, lval_slice(l, n, l->count - n));
 }
 
-// function for defining variables
-lval* builtin_var(lenv* e, lval* a, char* func) {
-    // LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'def' passed incorrect type!");
-    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
+// element of a list
+lval* builtin_elem(lenv* e, lval* a) {
+    LASSERT_NUM("elem", a, 2);
+    LASSERT_TYPE("elem", a, 1, LVAL_QEXPR);
+
+    lval* l = a->cell[1];
+    int found = 0;
+    for (int i = 0; i < l->count && !found; i++) {
+        lval* y = lval_elem(e, l->cell[i]);
+        if (lval_type(y) == LVAL_ERR) { lval_del(a); return y; }
+        found = lval_eq(a->cell[0], y);
+        lval_del(y);
+    }
 
-    /* First argument is symbol list */
-    lval* syms = a->cell[0];
+    lval_del(a);
+    return lval_num(found);
+}
 
-    /* Ensure all elements of first list are symbols */
-    for (int i = 0; i < syms->count; i++) {
-        LASSERT(a, syms->cell[i]->type == LVAL_SYM, "Function '%s' cannot define non-symbol. Got %s, Expected %s.", func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+// call "f" with a single element of a list
+lval* lval_apply_elem(lenv* e, lval* f, lval* x) {
+    lval* y = lval_elem(e, x);
+    if (lval_type(y) == LVAL_ERR) { return y; }
+    return lval_apply(e, lval_copy(f), lval_add(lval_sexpr(), y));
+}
+
+// Apply Function to List
+lval* builtin_map(lenv* e, lval* a) {
+    LASSERT_NUM("map", a, 2);
+    LASSERT_TYPE("map", a, 0, LVAL_FUN);
+    LASSERT_TYPE("map", a, 1, LVAL_QEXPR);
+
+    lval* l = a->cell[1];
+    lval* x = lval_qexpr();
+    lval_reserve(x, 0, l->count);
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_apply_elem(e, a->cell[0], l->cell[i]);
+        if (lval_type(y) == LVAL_ERR) { lval_del(x); lval_del(a); return y; }
+        lval_add(x, y);
     }
 
-    /* Check correct number of symbols and values */
-    LASSERT(a, (syms->count == a->count - 1), "Function '%s' passed too many arguments for symbols. Got %i, Expected %i.", func, syms->count, a->count-1);
+    lval_del(a);
+    return x;
+}
 
-    /* Assign copies of values to symbols */
-    for (int i = 0; i < syms->count; i++) {
-        /* If 'def' define in globally. If 'put' define in locally */
-        if (strcmp(func, "def") == 0) {
-            lenv_def(e, syms->cell[i], a->cell[i+1]);
+// Apply Filter to a list
+lval* builtin_filter(lenv* e, lval* a) {
+    LASSERT_NUM("filter", a, 2);
+    LASSERT_TYPE("filter", a, 0, LVAL_FUN);
+    LASSERT_TYPE("filter", a, 1, LVAL_QEXPR);
+
+    lval* l = a->cell[1];
+    lval* x = lval_qexpr();
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_apply_elem(e, a->cell[0], l->cell[i]);
+        if (lval_type(y) != LVAL_NUM) {
+            if (lval_type(y) != LVAL_ERR) {
+                lval* err = lval_err("Function 'filter' expected a Number from its predicate. Got %s.", ltype_name(lval_type(y)));
+                lval_del(y);
+                y = err;
+            }
+            lval_del(x); lval_del(a);
+            return y;
         }
 
-        if (strcmp(func, "=") == 0) {
-            lenv_put(e, syms->cell[i], a->cell[i+1]);
-        }
-        
+        /* Keep the element as it was written, like 'head' */
+        if (lval_int(y)) { lval_add(x, lval_copy(l->cell[i])); }
+        lval_del(y);
     }
 
     lval_del(a);
-    return lval_sexpr();
+    return x;
 }
 
-lval* builtin_def(lenv* e, lval* a) {
-    return builtin_var(e, a, "def");
-}
+// Fold left
+lval* builtin_foldl(lenv* e, lval* a) {
+    LASSERT_NUM("foldl", a, 3);
+    LASSERT_TYPE("foldl", a, 0, LVAL_FUN);
+    LASSERT_TYPE("foldl", a, 2, LVAL_QEXPR);
+
+    lval* l = a->cell[2];
+    lval* z = lval_copy(a->cell[1]);
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_elem(e, l->cell[i]);
+        if (lval_type(y) == LVAL_ERR) { lval_del(z); z = y; break; }
+
+        lval* args = lval_add(lval_add(lval_sexpr(), z), y);
+        z = lval_apply(e, lval_copy(a->cell[0]), args);
+        if (lval_type(z) == LVAL_ERR) { break; }
+    }
 
-lval* builtin_put(lenv* e, lval* a) {
-    return builtin_var(e, a, "=");
+    lval_del(a);
+    return z;
 }
 
-// builtin for our lambda function
-lval* builtin_lambda(lenv* e, lval* a) {
-    /* Check Two arguments, each of which are Q-Expressions */
-    LASSERT_NUM("\\", a, 2);
-    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
-    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+// sum or product of a list, as one call of '+' or '*' on all its elements
+// or of a vector by its own kernels
+lval* builtin_reduce(lenv* e, lval* a, char* func, int op, long z) {
+    LASSERT_NUM(func, a, 1);
+    if (lval_type(a->cell[0]) == LVAL_VEC) { return lvec_reduce(a, op); }
+    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
 
-    /* Check first Q-Expression contains only Symbols */
-    for (int i = 0; i < a->cell[0]->count; i++) {
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM), 
-        "Cannot define non-symbol. Got %s, Expected %s.",
-        ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+    lval* l = a->cell[0];
+    lval* args = lval_add(lval_sexpr(), lval_num(z));
+    lval_reserve(args, 0, l->count);
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_elem(e, l->cell[i]);
+        if (lval_type(y) == LVAL_ERR) { lval_del(args); lval_del(a); return y; }
+        lval_add(args, y);
     }
 
-    /* Pop first two arguments and pass them to lval_lambdas */
-    lval* formals = lval_pop(a, 0);
-    lval* body = lval_pop(a, 0);
     lval_del(a);
+    return builtin_op(e, args, op);
+}
 
-    return lval_lambda(formals, body);
+lval* builtin_sum(lenv* e, lval* a) {
+    return builtin_reduce(e, a, "sum", LOP_ADD, 0);
 }
 
-// order
-lval* builtin_ord(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    LASSERT_TYPE(op, a, 0, LVAL_NUM);
-    LASSERT_TYPE(op, a, 1, LVAL_NUM);
+lval* builtin_product(lenv* e, lval* a) {
+    return builtin_reduce(e, a, "product", LOP_MUL, 1);
+}
 
-    int r;
-    if (strcmp(op, ">") == 0) {
-        r = (a->cell[0]->num > a->cell[1]->num);
-    }
-    if (strcmp(op, "<") == 0) {
-        r = (a->cell[0]->num < a->cell[1]->num);
-    }
-    if (strcmp(op, ">=") == 0) {
-        r = (a->cell[0]->num >= a->cell[1]->num);
-    }
-    if (strcmp(op, "<=") == 0) {
-        r = (a->cell[0]->num <= a->cell[1]->num);
+// all of list but last element
+lval* builtin_init(lenv* e, lval* a) {
+    LASSERT_NUM("init", a, 1);
+    LASSERT_TYPE("init", a, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("init", a, 0);
+
+    lval* l = lval_take(a, 0);
+    return lval_slice(l, 0, l->count - 1);
+}
+
+// reverse list
+lval* builtin_reverse(lenv* e, lval* a) {
+    LASSERT_NUM("reverse", a, 1);
+    LASSERT_TYPE("reverse", a, 0, LVAL_QEXPR);
+
+    lval* l = a->cell[0];
+    lval* x = lval_qexpr();
+    lval_reserve(x, 0, l->count);
+    for (int i = l->count-1; i >= 0; i--) {
+        lval_add(x, lval_copy(l->cell[i]));
     }
+
     lval_del(a);
-    return lval_num(r);
+    return x;
 }
 
-lval* builtin_gt(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">");
-}
+// check the arguments to eval and return the expression to evaluate
+lval* builtin_eval_expr(lval* a) {
+    LASSERT_NUM("eval", a, 1);
+    LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
-lval* builtin_lt(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<");
+    lval* x = lval_take(a, 0);
+    x->type = LVAL_SEXPR;
+    return x;
 }
 
-lval* builtin_ge(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">=");
+// builtin eval
+lval* builtin_eval(lenv* e, lval* a) {
+    lval* x = builtin_eval_expr(a);
+    if (lval_type(x) == LVAL_ERR) { return x; }
+    return lval_eval(e, x);
 }
 
-lval* builtin_le(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<=");
+// x + y, x - y and x * y into "r", returning non-zero instead when the result does not fit a long
+int lnum_add(long x, long y, long* r) {
+#ifdef __GNUC__
+    return __builtin_add_overflow(x, y, r);
+#else
+    if (y > 0 ? x > LONG_MAX - y : x < LONG_MIN - y) { return 1; }
+    *r = x + y;
+    return 0;
+#endif
 }
 
-// function for equality
-int lval_eq(lval* x, lval* y) {
+int lnum_sub(long x, long y, long* r) {
+#ifdef __GNUC__
+    return __builtin_sub_overflow(x, y, r);
+#else
+    if (y < 0 ? x > LONG_MAX + y : x < LONG_MIN + y) { return 1; }
+    *r = x - y;
+    return 0;
+#endif
+}
 
-    /* Different Types are always unequal */
-    if (x->type != y->type) { return 0; }
+int lnum_mul(long x, long y, long* r) {
+#ifdef __GNUC__
+    return __builtin_mul_overflow(x, y, r);
+#else
+    if (x > 0 ? (y > 0 ? x > LONG_MAX / y : y < LONG_MIN / x)
+              : (y > 0 ? x < LONG_MIN / y : x != 0 && y < LONG_MAX / x)) { return 1; }
+    *r = x * y;
+    return 0;
+#endif
+}
+
+// x ^ y on bignums by squaring, NULL when the result would be too large to hold
+lbig* lbig_expo(lbig* x, long y) {
+    if (lbig_bits(x) > 1 && lbig_bits(x) * (double)y > LBIG_MAX_BITS) { return NULL; }
+    lbig* r = lbig_from_long(1);
+    lbig* sq = lbig_copy(x);
+    while (y) {
+        lbig* t;
+        if (y & 1) { t = lbig_mul(r, sq); free(r); r = t; }
+        y >>= 1;
+        if (y) { t = lbig_mul(sq, sq); free(sq); sq = t; }
+    }
+    free(sq);
+    return r;
+}
+
+// remainder of "x" by the magnitude of "m", from 0 up to |m| - 1
+lbig* lbig_mod(lbig* x, lbig* m) {
+    lbig* r;
+    free(lbig_divmod(x, m, &r));
+    if (r->neg) {
+        lbig* t = lbig_add(r, m, m->neg);
+        free(r);
+        r = t;
+    }
+    return r;
+}
+
+// b ^ e mod |m| on bignums, "e" not negative and "m" not zero
+lbig* lbig_powmod(lbig* b, lbig* e, lbig* m) {
+    lbig* sq = lbig_mod(b, m);
+    lbig* one = lbig_from_long(1);
+    lbig* r = lbig_mod(one, m);
+    free(one);
+
+    /* Square and multiply over the bits of "e", reducing after each product */
+    long bits = lbig_bits(e);
+    for (long i = 0; i < bits; i++) {
+        lbig* t;
+        if (e->d[i / 32] >> (i % 32) & 1) {
+            t = lbig_mul(r, sq); free(r);
+            r = lbig_mod(t, m); free(t);
+        }
+        if (i + 1 < bits) {
+            t = lbig_mul(sq, sq); free(sq);
+            sq = lbig_mod(t, m); free(t);
+        }
+    }
+    free(sq);
+    return r;
+}
+
+// one step of "op" on bignums, or an error
+lval* lbig_op(lbig** x, lbig* y, int op) {
+    lbig* r = NULL;
+    lbig* rem;
+    switch (op) {
+        case LOP_ADD: r = lbig_add(*x, y, 0); break;
+        case LOP_SUB: r = lbig_add(*x, y, 1); break;
+        case LOP_MUL:
+            if (lbig_bits(*x) + lbig_bits(y) > LBIG_MAX_BITS) {
+                return lval_err("Function '*' result too large.");
+            }
+            r = lbig_mul(*x, y);
+            break;
+        case LOP_DIV:
+        case LOP_MOD:
+            if (!y->size) {
+                return lval_err(op == LOP_DIV ? "Division By Zero!" : "Modulus by Zero--not a number!");
+            }
+            r = lbig_divmod(*x, y, &rem);
+            if (op == LOP_MOD) { free(r); r = rem; } else { free(rem); }
+            break;
+        case LOP_EXP: {
+            long n;
+            /* Bases 0, 1 and -1 take any exponent, as expo does for longs */
+            if (lbig_bits(*x) <= 1) {
+                if (!(*x)->size && y->neg) { return lval_err("Division By Zero!"); }
+                n = !(*x)->size ? !y->size : ((*x)->neg && y->size && (y->d[0] & 1)) ? -1 : 1;
+                r = lbig_from_long(n);
+                break;
+            }
+            /* Any other base to a negative power truncates to zero */
+            if (y->neg) {
+                r = lbig_new(0);
+                break;
+            }
+            if (!lbig_fits(y, &n) || !(r = lbig_expo(*x, n))) {
+                return lval_err("Function '^' result too large.");
+            }
+            break;
+        }
+    }
+    free(*x);
+    *x = r;
+    return NULL;
+}
+
+// carry on with "op" from element "i" of "a", the value so far being "f"
+lval* lnum_op_dbl(lval* a, int op, int i, double f) {
+
+    /* If no arguments and sub then perform unary negation */
+    if (op == LOP_SUB && a->count == 1) { f = -f; }
+
+    for (; i < a->count; i++) {
+        double y = lnum_double(a->cell[i]);
+        if ((op == LOP_DIV || op == LOP_MOD) && y == 0) {
+            lval_del(a);
+            return lval_err(op == LOP_DIV ? "Division By Zero!" : "Modulus by Zero--not a number!");
+        }
+        switch (op) {
+            case LOP_ADD: f += y; break;
+            case LOP_SUB: f -= y; break;
+            case LOP_MUL: f *= y; break;
+            case LOP_DIV: f /= y; break;
+            case LOP_MOD: f = fmod(f, y); break;
+            case LOP_EXP: f = pow(f, y); break;
+        }
+    }
+
+    lval_del(a);
+    return lval_dbl(f);
+}
+
+lval* builtin_op(lenv* e, lval* a, int op) {
+
+    /* Ensure all arguments are numbers, or hand vectors over to their own kernels */
+    for (int i = 0; i < a->count; i++) {
+        if (!lval_is_number(a->cell[i]) && lval_type(a->cell[i]) == LVAL_VEC) { return lvec_arith(a, op); }
+        LASSERT_NUMBER(lop_names[op], a, i);
+    }
+
+    /* Floats are left to their own loop */
+    if (lval_type(a->cell[0]) == LVAL_DBL) { return lnum_op_dbl(a, op, 1, a->cell[0]->dbl); }
+
+    /* Work on the value of the first element as a long, */
+    /* or as a bignum from the first operation that overflows one */
+    long x = 0;
+    lbig* big = NULL;
+    if (lval_type(a->cell[0]) == LVAL_BIG) {
+        big = lbig_copy(a->cell[0]->big);
+    } else {
+        x = lval_int(a->cell[0]);
+    }
+
+    /* If no arguments and sub then perform unary negation */
+    if (op == LOP_SUB && a->count == 1) {
+        if (big) {
+            big->neg = !big->neg;
+        } else if (x == LONG_MIN) {
+            big = lbig_from_long(x);
+            big->neg = 0;
+        } else {
+            x = -x;
+        }
+    }
+
+    /* For each of the remaining elements */
+    for (int i = 1; i < a->count; i++) {
+        lval* yv = a->cell[i];
+
+        /* Longs take a single checked operation, falling through on overflow */
+        if (!big && lval_type(yv) == LVAL_NUM) {
+            long y = lval_int(yv);
+            long r = 0;
+            int over = 0;
+
+            switch (op) {
+                case LOP_ADD: over = lnum_add(x, y, &r); break;
+                case LOP_SUB: over = lnum_sub(x, y, &r); break;
+                case LOP_MUL: over = lnum_mul(x, y, &r); break;
+                case LOP_MOD:
+                    if (y == 0) {
+                        lval_del(a);
+                        return lval_err("Modulus by Zero--not a number!");
+                    }
+                    /* LONG_MIN % -1 overflows in C, though the answer is 0 */
+                    r = (y == -1) ? 0 : x % y;
+                    break;
+                case LOP_EXP:
+                    if (x == 0 && y < 0) {
+                        lval_del(a);
+                        return lval_err("Division By Zero!");
+                    }
+                    over = expo(x, y, &r);
+                    break;
+                case LOP_DIV:
+                    if (y == 0) {
+                        lval_del(a);
+                        return lval_err("Division By Zero!");
+                    }
+                    over = (x == LONG_MIN && y == -1);
+                    if (!over) { r = x / y; }
+                    break;
+            }
+            if (!over) { x = r; continue; }
+        }
+
+        /* A float turns the rest of the operation over to doubles */
+        if (lval_type(yv) == LVAL_DBL) {
+            double f = big ? lbig_double(big) : (double)x;
+            free(big);
+            return lnum_op_dbl(a, op, i, f);
+        }
+
+        /* Otherwise the step is made on bignums */
+        if (!big) { big = lbig_from_long(x); }
+        lbig* y = (lval_type(yv) == LVAL_BIG) ? lbig_copy(yv->big) : lbig_from_long(lval_int(yv));
+        lval* err = lbig_op(&big, y, op);
+        free(y);
+        if (err) {
+            free(big);
+            lval_del(a);
+            return err;
+        }
+
+        /* Going back to a long once the result fits one again */
+        if (lbig_fits(big, &x)) {
+            free(big);
+            big = NULL;
+        }
+    }
+
+    lval_del(a);
+    return big ? lval_big(big) : lval_num(x);
+}
+
+// define separate builtins for each of the maths functions
+lval* builtin_add(lenv* e, lval* a) {
+    return builtin_op(e, a, LOP_ADD);
+}
+
+lval* builtin_sub(lenv* e, lval* a) {
+    return builtin_op(e, a, LOP_SUB);
+}
+
+lval* builtin_mul(lenv* e, lval* a) {
+    return builtin_op(e, a, LOP_MUL);
+}
+
+lval* builtin_div(lenv* e, lval* a) {
+    return builtin_op(e, a, LOP_DIV);
+}
+
+lval* builtin_mod(lenv* e, lval* a) {
+    return builtin_op(e, a, LOP_MOD);
+}
+
+lval* builtin_exp(lenv* e, lval* a) {
+    return builtin_op(e, a, LOP_EXP);
+}
+
+// a * b mod m without overflowing, for "a" and "b" below "m"
+unsigned long lnum_mulmod(unsigned long a, unsigned long b, unsigned long m) {
+#ifdef __SIZEOF_INT128__
+    return (unsigned long)((unsigned __int128)a * b % m);
+#else
+    /* Double and add, every partial sum staying below "m" */
+    unsigned long r = 0;
+    while (b) {
+        if (b & 1) { r = (r >= m - a) ? r - (m - a) : r + a; }
+        a = (a >= m - a) ? a - (m - a) : a + a;
+        b >>= 1;
+    }
+    return r;
+#endif
+}
+
+// modular power, (powmod b e m) is b ^ e mod m from 0 up to |m| - 1
+lval* builtin_powmod(lenv* e, lval* a) {
+    LASSERT_NUM("powmod", a, 3);
+    for (int i = 0; i < 3; i++) { LASSERT_INTEGER("powmod", a, i); }
+
+    lval* b = a->cell[0];
+    lval* y = a->cell[1];
+    lval* m = a->cell[2];
+    LASSERT(a, lnum_cmp(y, lval_num(0)) >= 0, "Function 'powmod' passed a negative exponent.");
+    LASSERT(a, lnum_cmp(m, lval_num(0)) != 0, "Modulus by Zero--not a number!");
+
+    /* Longs square and multiply without leaving the machine word */
+    if (lval_type(b) == LVAL_NUM && lval_type(y) == LVAL_NUM && lval_type(m) == LVAL_NUM) {
+        long mv = lval_int(m);
+        unsigned long um = mv < 0 ? 0 - (unsigned long)mv : (unsigned long)mv;
+        /* LONG_MIN % -1 overflows, as in builtin_op */
+        long bv = (mv == -1) ? 0 : lval_int(b) % mv;
+        unsigned long sq = bv < 0 ? (unsigned long)bv + um : (unsigned long)bv;
+        unsigned long r = 1 % um;
+        for (long n = lval_int(y); n; n >>= 1) {
+            if (n & 1) { r = lnum_mulmod(r, sq, um); }
+            sq = lnum_mulmod(sq, sq, um);
+        }
+        lval_del(a);
+        return lval_num((long)r);
+    }
+
+    /* Otherwise on bignums */
+    lbig* bb = lval_type(b) == LVAL_BIG ? lbig_copy(b->big) : lbig_from_long(lval_int(b));
+    lbig* yb = lval_type(y) == LVAL_BIG ? lbig_copy(y->big) : lbig_from_long(lval_int(y));
+    lbig* mb = lval_type(m) == LVAL_BIG ? lbig_copy(m->big) : lbig_from_long(lval_int(m));
+    lbig* r = lbig_powmod(bb, yb, mb);
+    free(bb); free(yb); free(mb);
+    lval_del(a);
+    return lval_big(r);
+}
+
+// function for defining variables
+lval* builtin_var(lenv* e, lval* a, char* func) {
+    // LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'def' passed incorrect type!");
+    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
+
+    /* First argument is symbol list */
+    lval* syms = a->cell[0];
+
+    /* Ensure all elements of first list are symbols */
+    for (int i = 0; i < syms->count; i++) {
+        LASSERT(a, lval_type(syms->cell[i]) == LVAL_SYM, "Function '%s' cannot define non-symbol. Got %s, Expected %s.", func, ltype_name(lval_type(syms->cell[i])), ltype_name(LVAL_SYM));
+    }
+
+    /* Check correct number of symbols and values */
+    LASSERT(a, (syms->count == a->count - 1), "Function '%s' passed too many arguments for symbols. Got %i, Expected %i.", func, syms->count, a->count-1);
+
+    /* Assign copies of values to symbols */
+    for (int i = 0; i < syms->count; i++) {
+        /* If 'def' define in globally. If 'put' define in locally */
+        if (strcmp(func, "def") == 0) {
+            lenv_def(e, syms->cell[i], a->cell[i+1]);
+        }
+
+        if (strcmp(func, "=") == 0) {
+            lenv_put(e, syms->cell[i], a->cell[i+1]);
+        }
+        
+    }
+
+    lval_del(a);
+    return lval_sexpr();
+}
+
+lval* builtin_def(lenv* e, lval* a) {
+    return builtin_var(e, a, "def");
+}
+
+lval* builtin_put(lenv* e, lval* a) {
+    return builtin_var(e, a, "=");
+}
+
+// builtin for our lambda function
+lval* builtin_lambda(lenv* e, lval* a) {
+    /* Check Two arguments, each of which are Q-Expressions */
+    LASSERT_NUM("\\", a, 2);
+    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+
+    /* Check first Q-Expression contains only Symbols */
+    for (int i = 0; i < a->cell[0]->count; i++) {
+        LASSERT(a, (lval_type(a->cell[0]->cell[i]) == LVAL_SYM), 
+        "Cannot define non-symbol. Got %s, Expected %s.",
+        ltype_name(lval_type(a->cell[0]->cell[i])), ltype_name(LVAL_SYM));
+    }
+
+    /* Pop first two arguments and pass them to lval_lambdas */
+    lval* formals = lval_pop(a, 0);
+    lval* body = lval_pop(a, 0);
+    lval_del(a);
+
+    /* Resolve references before the body is compiled or copied */
+    lval_resolve(body, formals, e);
+    return lval_lambda(formals, body);
+}
+
+// value of any number as the nearest double
+double lnum_double(lval* v) {
+    switch (lval_type(v)) {
+        case LVAL_DBL: return v->dbl;
+        case LVAL_BIG: return lbig_double(v->big);
+        default: return (double)lval_int(v);
+    }
+}
+
+// compare the bignum "big", or the long "a" when it is NULL, with "d" exactly
+// -1, 0 or 1, and 0 when "d" is NaN, which callers check for themselves
+int lnum_cmp_dbl(long a, lbig* big, double d) {
+    if (isnan(d)) { return 0; }
+    if (isinf(d)) { return d > 0 ? -1 : 1; }
+
+    /* Compare with the whole part of "d", its fraction only breaking a tie */
+    double t = trunc(d);
+    int c;
+    if (t >= (double)LONG_MIN && t < -(double)LONG_MIN) {
+        long b = (long)t;
+        c = big ? (big->neg ? -1 : 1) : (a > b) - (a < b);
+    } else if (!big) {
+        c = t > 0 ? -1 : 1;
+    } else {
+        lbig* b = lbig_from_double(t);
+        c = lbig_cmp(big, b);
+        free(b);
+    }
+    return c ? c : (t < d) ? -1 : (t > d);
+}
+
+// order
+// compare two numbers, -1, 0 or 1
+// a bignum is larger in magnitude than any long, so only its sign matters against one
+int lnum_cmp(lval* x, lval* y) {
+    int tx = lval_type(x), ty = lval_type(y);
+    if (tx == LVAL_DBL && ty == LVAL_DBL) { return (x->dbl > y->dbl) - (x->dbl < y->dbl); }
+    if (ty == LVAL_DBL) { return lnum_cmp_dbl(tx == LVAL_BIG ? 0 : lval_int(x), tx == LVAL_BIG ? x->big : NULL, y->dbl); }
+    if (tx == LVAL_DBL) { return -lnum_cmp_dbl(ty == LVAL_BIG ? 0 : lval_int(y), ty == LVAL_BIG ? y->big : NULL, x->dbl); }
+    if (tx == LVAL_BIG && ty == LVAL_BIG) { return lbig_cmp(x->big, y->big); }
+    if (tx == LVAL_BIG) { return x->big->neg ? -1 : 1; }
+    if (ty == LVAL_BIG) { return y->big->neg ? 1 : -1; }
+    long a = lval_int(x), b = lval_int(y);
+    return (a > b) - (a < b);
+}
+
+lval* builtin_ord(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lop_names[op], a, 2);
+    for (int i = 0; i < 2; i++) {
+        if (!lval_is_number(a->cell[i]) && lval_type(a->cell[i]) == LVAL_VEC) { return lvec_ord(a, op); }
+    }
+    LASSERT_NUMBER(lop_names[op], a, 0);
+    LASSERT_NUMBER(lop_names[op], a, 1);
+
+    /* NaN is unordered, every comparison with it is false */
+    int c = lnum_cmp(a->cell[0], a->cell[1]);
+    int r = 0;
+    for (int i = 0; i < 2; i++) {
+        if (lval_type(a->cell[i]) == LVAL_DBL && isnan(a->cell[i]->dbl)) { op = -1; }
+    }
+    switch (op) {
+        case LOP_GT: r = (c > 0); break;
+        case LOP_LT: r = (c < 0); break;
+        case LOP_GE: r = (c >= 0); break;
+        case LOP_LE: r = (c <= 0); break;
+    }
+    lval_del(a);
+    return lval_num(r);
+}
+
+lval* builtin_gt(lenv* e, lval* a) {
+    return builtin_ord(e, a, LOP_GT);
+}
+
+lval* builtin_lt(lenv* e, lval* a) {
+    return builtin_ord(e, a, LOP_LT);
+}
+
+lval* builtin_ge(lenv* e, lval* a) {
+    return builtin_ord(e, a, LOP_GE);
+}
+
+lval* builtin_le(lenv* e, lval* a) {
+    return builtin_ord(e, a, LOP_LE);
+}
+
+/* Packed Vectors */
+
+/* Kernels take a register of elements at a time and finish the rest one by one */
+/* Their lanes are 64 bits wide, so longs must be too */
+#if (defined(__AVX2__) || defined(__SSE2__)) && LONG_MAX == 0x7fffffffffffffffL
+#if defined(__AVX2__)
+#define LVEC_LANES 4
+typedef __m256d lvec_pd;
+typedef __m256i lvec_pi;
+#define lvec_load_pd(p) _mm256_loadu_pd(p)
+#define lvec_store_pd(p, x) _mm256_storeu_pd(p, x)
+#define lvec_set1_pd(x) _mm256_set1_pd(x)
+#define lvec_add_pd(x, y) _mm256_add_pd(x, y)
+#define lvec_sub_pd(x, y) _mm256_sub_pd(x, y)
+#define lvec_mul_pd(x, y) _mm256_mul_pd(x, y)
+#define lvec_div_pd(x, y) _mm256_div_pd(x, y)
+#define lvec_min_pd(x, y) _mm256_min_pd(x, y)
+#define lvec_max_pd(x, y) _mm256_max_pd(x, y)
+#define lvec_gt_pd(x, y) _mm256_castpd_si256(_mm256_cmp_pd(x, y, _CMP_GT_OQ))
+#define lvec_ge_pd(x, y) _mm256_castpd_si256(_mm256_cmp_pd(x, y, _CMP_GE_OQ))
+#define lvec_load_pi(p) _mm256_loadu_si256((__m256i*)(p))
+#define lvec_store_pi(p, x) _mm256_storeu_si256((__m256i*)(p), x)
+#define lvec_set1_pi(x) _mm256_set1_epi64x(x)
+#define lvec_add_pi(x, y) _mm256_add_epi64(x, y)
+#define lvec_sub_pi(x, y) _mm256_sub_epi64(x, y)
+#define lvec_and_pi(x, y) _mm256_and_si256(x, y)
+#define lvec_andnot_pi(x, y) _mm256_andnot_si256(x, y)
+#define lvec_or_pi(x, y) _mm256_or_si256(x, y)
+#define lvec_xor_pi(x, y) _mm256_xor_si256(x, y)
+#define lvec_signs_pi(x) _mm256_movemask_pd(_mm256_castsi256_pd(x))
+/* Comparing 64 bit integers came with AVX2 */
+#define lvec_gt_pi(x, y) _mm256_cmpgt_epi64(x, y)
+#define lvec_blend_pi(x, y, m) _mm256_blendv_epi8(x, y, m)
+#else
+#define LVEC_LANES 2
+typedef __m128d lvec_pd;
+typedef __m128i lvec_pi;
+#define lvec_load_pd(p) _mm_loadu_pd(p)
+#define lvec_store_pd(p, x) _mm_storeu_pd(p, x)
+#define lvec_set1_pd(x) _mm_set1_pd(x)
+#define lvec_add_pd(x, y) _mm_add_pd(x, y)
+#define lvec_sub_pd(x, y) _mm_sub_pd(x, y)
+#define lvec_mul_pd(x, y) _mm_mul_pd(x, y)
+#define lvec_div_pd(x, y) _mm_div_pd(x, y)
+#define lvec_min_pd(x, y) _mm_min_pd(x, y)
+#define lvec_max_pd(x, y) _mm_max_pd(x, y)
+#define lvec_gt_pd(x, y) _mm_castpd_si128(_mm_cmpgt_pd(x, y))
+#define lvec_ge_pd(x, y) _mm_castpd_si128(_mm_cmpge_pd(x, y))
+#define lvec_load_pi(p) _mm_loadu_si128((__m128i*)(p))
+#define lvec_store_pi(p, x) _mm_storeu_si128((__m128i*)(p), x)
+#define lvec_set1_pi(x) _mm_set1_epi64x(x)
+#define lvec_add_pi(x, y) _mm_add_epi64(x, y)
+#define lvec_sub_pi(x, y) _mm_sub_epi64(x, y)
+#define lvec_and_pi(x, y) _mm_and_si128(x, y)
+#define lvec_andnot_pi(x, y) _mm_andnot_si128(x, y)
+#define lvec_or_pi(x, y) _mm_or_si128(x, y)
+#define lvec_xor_pi(x, y) _mm_xor_si128(x, y)
+#define lvec_signs_pi(x) _mm_movemask_pd(_mm_castsi128_pd(x))
+#endif
+#endif
+
+// x op y element by element into "r" for + - * /
+// "xs" or "ys" is set when that side is a single number standing for every element
+void lvec_kern_dbl(int op, double* r, double* x, double* y, int n, int xs, int ys) {
+    int i = 0;
+#ifdef LVEC_LANES
+    lvec_pd xb = lvec_set1_pd(x[0]), yb = lvec_set1_pd(y[0]);
+#define LVEC_MAP_PD(f) \
+    for (; i + LVEC_LANES <= n; i += LVEC_LANES) { \
+        lvec_store_pd(r + i, f(xs ? xb : lvec_load_pd(x + i), ys ? yb : lvec_load_pd(y + i))); \
+    }
+    switch (op) {
+        case LOP_ADD: LVEC_MAP_PD(lvec_add_pd); break;
+        case LOP_SUB: LVEC_MAP_PD(lvec_sub_pd); break;
+        case LOP_MUL: LVEC_MAP_PD(lvec_mul_pd); break;
+        case LOP_DIV: LVEC_MAP_PD(lvec_div_pd); break;
+    }
+#undef LVEC_MAP_PD
+#endif
+    for (; i < n; i++) {
+        double a = x[xs ? 0 : i], b = y[ys ? 0 : i];
+        switch (op) {
+            case LOP_ADD: r[i] = a + b; break;
+            case LOP_SUB: r[i] = a - b; break;
+            case LOP_MUL: r[i] = a * b; break;
+            case LOP_DIV: r[i] = a / b; break;
+        }
+    }
+}
+
+// the same on longs, returning non-zero instead when an element overflows
+// divisors are checked for zero by the caller
+int lvec_kern_int(int op, long* r, long* x, long* y, int n, int xs, int ys) {
+    int i = 0;
+    int over = 0;
+#ifdef LVEC_LANES
+    /* An overflowing lane has a sign unlike both operands of an addition, */
+    /* gathered in the sign bits of "ov" */
+    if (op == LOP_ADD || op == LOP_SUB) {
+        lvec_pi xb = lvec_set1_pi(x[0]), yb = lvec_set1_pi(y[0]);
+        lvec_pi ov = lvec_set1_pi(0);
+        for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+            lvec_pi a = xs ? xb : lvec_load_pi(x + i);
+            lvec_pi b = ys ? yb : lvec_load_pi(y + i);
+            lvec_pi c;
+            if (op == LOP_ADD) {
+                c = lvec_add_pi(a, b);
+                ov = lvec_or_pi(ov, lvec_and_pi(lvec_xor_pi(a, c), lvec_xor_pi(b, c)));
+            } else {
+                c = lvec_sub_pi(a, b);
+                ov = lvec_or_pi(ov, lvec_and_pi(lvec_xor_pi(a, b), lvec_xor_pi(a, c)));
+            }
+            lvec_store_pi(r + i, c);
+        }
+        over = (lvec_signs_pi(ov) != 0);
+    }
+#endif
+    /* There are no 64 bit multiplies or divides across lanes */
+    for (; i < n && !over; i++) {
+        long a = x[xs ? 0 : i], b = y[ys ? 0 : i];
+        switch (op) {
+            case LOP_ADD: over = lnum_add(a, b, r + i); break;
+            case LOP_SUB: over = lnum_sub(a, b, r + i); break;
+            case LOP_MUL: over = lnum_mul(a, b, r + i); break;
+            case LOP_DIV:
+                over = (a == LONG_MIN && b == -1);
+                if (!over) { r[i] = a / b; }
+                break;
+        }
+    }
+    return over;
+}
+
+// x > y, or x >= y when "ge" is set, element by element as 1 or 0 into "r"
+void lvec_cmp_dbl(int ge, long* r, double* x, double* y, int n, int xs, int ys) {
+    int i = 0;
+#ifdef LVEC_LANES
+    lvec_pd xb = lvec_set1_pd(x[0]), yb = lvec_set1_pd(y[0]);
+    lvec_pi one = lvec_set1_pi(1);
+    for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+        lvec_pd a = xs ? xb : lvec_load_pd(x + i);
+        lvec_pd b = ys ? yb : lvec_load_pd(y + i);
+        lvec_store_pi(r + i, lvec_and_pi(ge ? lvec_ge_pd(a, b) : lvec_gt_pd(a, b), one));
+    }
+#endif
+    for (; i < n; i++) {
+        double a = x[xs ? 0 : i], b = y[ys ? 0 : i];
+        r[i] = ge ? (a >= b) : (a > b);
+    }
+}
+
+void lvec_cmp_int(int ge, long* r, long* x, long* y, int n, int xs, int ys) {
+    int i = 0;
+#ifdef lvec_gt_pi
+    lvec_pi xb = lvec_set1_pi(x[0]), yb = lvec_set1_pi(y[0]);
+    lvec_pi one = lvec_set1_pi(1);
+    for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+        lvec_pi a = xs ? xb : lvec_load_pi(x + i);
+        lvec_pi b = ys ? yb : lvec_load_pi(y + i);
+        /* x >= y is not y > x */
+        lvec_store_pi(r + i, ge ? lvec_andnot_pi(lvec_gt_pi(b, a), one) : lvec_and_pi(lvec_gt_pi(a, b), one));
+    }
+#endif
+    for (; i < n; i++) {
+        long a = x[xs ? 0 : i], b = y[ys ? 0 : i];
+        r[i] = ge ? (a >= b) : (a > b);
+    }
+}
+
+// sum or product of doubles, with a running total in each lane
+double lvec_fold_dbl(int op, double* x, int n) {
+    double r = (op == LOP_ADD) ? 0 : 1;
+    int i = 0;
+#ifdef LVEC_LANES
+    if (n >= LVEC_LANES) {
+        lvec_pd acc = lvec_set1_pd(r);
+        for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+            lvec_pd b = lvec_load_pd(x + i);
+            acc = (op == LOP_ADD) ? lvec_add_pd(acc, b) : lvec_mul_pd(acc, b);
+        }
+        double t[LVEC_LANES];
+        lvec_store_pd(t, acc);
+        for (int k = 0; k < LVEC_LANES; k++) { r = (op == LOP_ADD) ? r + t[k] : r * t[k]; }
+    }
+#endif
+    for (; i < n; i++) { r = (op == LOP_ADD) ? r + x[i] : r * x[i]; }
+    return r;
+}
+
+// sum of longs into "r", returning non-zero instead when a running total overflows
+int lvec_sum_int(long* x, int n, long* r) {
+    long s = 0;
+    int i = 0;
+#ifdef LVEC_LANES
+    if (n >= LVEC_LANES) {
+        lvec_pi acc = lvec_set1_pi(0);
+        lvec_pi ov = acc;
+        for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+            lvec_pi b = lvec_load_pi(x + i);
+            lvec_pi c = lvec_add_pi(acc, b);
+            ov = lvec_or_pi(ov, lvec_and_pi(lvec_xor_pi(acc, c), lvec_xor_pi(b, c)));
+            acc = c;
+        }
+        if (lvec_signs_pi(ov)) { return 1; }
+        long t[LVEC_LANES];
+        lvec_store_pi(t, acc);
+        for (int k = 0; k < LVEC_LANES; k++) {
+            if (lnum_add(s, t[k], &s)) { return 1; }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (lnum_add(s, x[i], &s)) { return 1; }
+    }
+    *r = s;
+    return 0;
+}
+
+// product of longs into "r", returning non-zero instead when it overflows
+int lvec_product_int(long* x, int n, long* r) {
+    long p = 1;
+    for (int i = 0; i < n; i++) {
+        if (lnum_mul(p, x[i], &p)) { return 1; }
+    }
+    *r = p;
+    return 0;
+}
+
+// sum of the products of the elements of "x" and "y"
+double lvec_dot_dbl(double* x, double* y, int n) {
+    double r = 0;
+    int i = 0;
+#ifdef LVEC_LANES
+    if (n >= LVEC_LANES) {
+        lvec_pd acc = lvec_set1_pd(0);
+        for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+            acc = lvec_add_pd(acc, lvec_mul_pd(lvec_load_pd(x + i), lvec_load_pd(y + i)));
+        }
+        double t[LVEC_LANES];
+        lvec_store_pd(t, acc);
+        for (int k = 0; k < LVEC_LANES; k++) { r += t[k]; }
+    }
+#endif
+    for (; i < n; i++) { r += x[i] * y[i]; }
+    return r;
+}
+
+int lvec_dot_int(long* x, long* y, int n, long* r) {
+    long s = 0, p;
+    for (int i = 0; i < n; i++) {
+        if (lnum_mul(x[i], y[i], &p) || lnum_add(s, p, &s)) { return 1; }
+    }
+    *r = s;
+    return 0;
+}
+
+// smallest, or largest when "max" is set, of "n" > 0 doubles
+double lvec_extreme_dbl(int max, double* x, int n) {
+    double r = x[0];
+    int i = 1;
+#ifdef LVEC_LANES
+    if (n >= LVEC_LANES) {
+        lvec_pd acc = lvec_load_pd(x);
+        for (i = LVEC_LANES; i + LVEC_LANES <= n; i += LVEC_LANES) {
+            lvec_pd b = lvec_load_pd(x + i);
+            acc = max ? lvec_max_pd(acc, b) : lvec_min_pd(acc, b);
+        }
+        double t[LVEC_LANES];
+        lvec_store_pd(t, acc);
+        for (int k = 0; k < LVEC_LANES; k++) { r = (max ? t[k] > r : t[k] < r) ? t[k] : r; }
+    }
+#endif
+    for (; i < n; i++) { r = (max ? x[i] > r : x[i] < r) ? x[i] : r; }
+    return r;
+}
+
+long lvec_extreme_int(int max, long* x, int n) {
+    long r = x[0];
+    int i = 1;
+#ifdef lvec_gt_pi
+    if (n >= LVEC_LANES) {
+        lvec_pi acc = lvec_load_pi(x);
+        for (i = LVEC_LANES; i + LVEC_LANES <= n; i += LVEC_LANES) {
+            lvec_pi b = lvec_load_pi(x + i);
+            acc = lvec_blend_pi(acc, b, max ? lvec_gt_pi(b, acc) : lvec_gt_pi(acc, b));
+        }
+        long t[LVEC_LANES];
+        lvec_store_pi(t, acc);
+        for (int k = 0; k < LVEC_LANES; k++) { r = (max ? t[k] > r : t[k] < r) ? t[k] : r; }
+    }
+#endif
+    for (; i < n; i++) { r = (max ? x[i] > r : x[i] < r) ? x[i] : r; }
+    return r;
+}
+
+// whether two vectors hold equal numbers, longs and doubles compared exactly
+int lvec_eq(lvec* x, lvec* y) {
+    if (x->count != y->count) { return 0; }
+    for (int i = 0; i < x->count; i++) {
+        if (!x->dbl && !y->dbl) {
+            if (x->i[i] != y->i[i]) { return 0; }
+        } else if (x->dbl && y->dbl) {
+            if (x->f[i] != y->f[i]) { return 0; }
+        } else {
+            double d = x->dbl ? x->f[i] : y->f[i];
+            if (isnan(d) || lnum_cmp_dbl(x->dbl ? y->i[i] : x->i[i], NULL, d)) { return 0; }
+        }
+    }
+    return 1;
+}
+
+/* A number standing for every element of a vector */
+typedef union { long i; double f; } lvec_one;
+
+// whether a vector operation on "v" must work on doubles
+int lvec_wants_dbl(lval* v) {
+    return lval_type(v) == LVAL_DBL || (lval_type(v) == LVAL_VEC && v->vec->dbl);
+}
+
+// elements of "v" as doubles or longs, a number being put in "one" to stand for them all
+// a vector of longs is turned into doubles where it is, unless its storage is shared
+void* lvec_operand(lval* v, int dbl, lvec_one* one) {
+    if (lval_type(v) != LVAL_VEC) {
+        if (dbl) { one->f = lnum_double(v); } else { one->i = lval_int(v); }
+        return one;
+    }
+    lvec* x = v->vec;
+    if (dbl && !x->dbl) {
+        if (x->refs > 1) {
+            lvec* y = lvec_new(1, x->count);
+            for (int i = 0; i < x->count; i++) { y->f[i] = (double)x->i[i]; }
+            lvec_del(x);
+            v->vec = x = y;
+        } else {
+            /* From the end, so no long is written over before it is read */
+            for (int i = x->count - 1; i >= 0; i--) { x->f[i] = (double)x->i[i]; }
+            x->dbl = 1;
+        }
+    }
+    return x->f;
+}
+
+// check "v" may take part in a vector operation, a number of any kind but a bignum or a vector
+#define LASSERT_VEC_ARG(func, args, index) \
+    LASSERT(args, lval_type(args->cell[index]) == LVAL_VEC \
+        || lval_type(args->cell[index]) == LVAL_NUM || lval_type(args->cell[index]) == LVAL_DBL, \
+        "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+        func, index, ltype_name(lval_type(args->cell[index])), ltype_name(LVAL_VEC))
+
+// length of the vectors among the two arguments in "a", -1 when they differ
+int lvec_len(lval* a) {
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
+    if (lval_type(x) != LVAL_VEC) { return y->vec->count; }
+    if (lval_type(y) != LVAL_VEC) { return x->vec->count; }
+    return x->vec->count == y->vec->count ? x->vec->count : -1;
+}
+
+#define LASSERT_VEC_LEN(func, args, n) \
+    LASSERT(args, n >= 0, "Function '%s' passed vectors of %i and %i elements.", \
+        func, args->cell[0]->vec->count, args->cell[1]->vec->count)
+
+// x op y for + - * /, at least one of the two arguments in "a" being a vector
+lval* lvec_binop(lval* a, int op) {
+    char* func = lop_names[op];
+    LASSERT(a, op <= LOP_DIV, "Function '%s' does not take vectors.", func);
+    LASSERT_VEC_ARG(func, a, 0);
+    LASSERT_VEC_ARG(func, a, 1);
+    int n = lvec_len(a);
+    LASSERT_VEC_LEN(func, a, n);
+
+    int dbl = lvec_wants_dbl(a->cell[0]) || lvec_wants_dbl(a->cell[1]);
+    int xs = lval_type(a->cell[0]) != LVAL_VEC, ys = lval_type(a->cell[1]) != LVAL_VEC;
+    lvec_one xo, yo;
+    void* x = lvec_operand(a->cell[0], dbl, &xo);
+    void* y = lvec_operand(a->cell[1], dbl, &yo);
+
+    /* Dividing by any zero element fails as it would for numbers */
+    if (op == LOP_DIV) {
+        for (int i = 0; i < (ys ? 1 : n); i++) {
+            LASSERT(a, dbl ? ((double*)y)[i] != 0 : ((long*)y)[i] != 0, "Division By Zero!");
+        }
+    }
+
+    lvec* r = lvec_new(dbl, n);
+    if (dbl) {
+        lvec_kern_dbl(op, r->f, x, y, n, xs, ys);
+    } else if (lvec_kern_int(op, r->i, x, y, n, xs, ys)) {
+        lvec_del(r);
+        lval_del(a);
+        return lval_err("Function '%s' overflowed a packed integer.", func);
+    }
+    lval_del(a);
+    return lval_vec(r);
+}
+
+// arithmetic with vectors among the arguments, folded from the left as for numbers
+lval* lvec_arith(lval* a, int op) {
+    lval* x = lval_pop(a, 0);
+
+    /* A lone argument to '-' is negated, as 0 - x */
+    if (op == LOP_SUB && a->count == 0) {
+        lval_add(a, x);
+        x = lval_num(0);
+    }
+
+    while (a->count) {
+        lval* args = lval_add(lval_add(lval_sexpr(), x), lval_pop(a, 0));
+        int vec = lval_type(args->cell[0]) == LVAL_VEC || lval_type(args->cell[1]) == LVAL_VEC;
+        x = vec ? lvec_binop(args, op) : builtin_op(NULL, args, op);
+        if (lval_type(x) == LVAL_ERR) { break; }
+    }
+    lval_del(a);
+    return x;
+}
+
+// x > y, x < y, x >= y or x <= y element by element into a vector of 1s and 0s
+lval* lvec_ord(lval* a, int op) {
+    char* func = lop_names[op];
+    LASSERT_VEC_ARG(func, a, 0);
+    LASSERT_VEC_ARG(func, a, 1);
+    int n = lvec_len(a);
+    LASSERT_VEC_LEN(func, a, n);
+
+    int dbl = lvec_wants_dbl(a->cell[0]) || lvec_wants_dbl(a->cell[1]);
+    int xs = lval_type(a->cell[0]) != LVAL_VEC, ys = lval_type(a->cell[1]) != LVAL_VEC;
+    lvec_one xo, yo;
+    void* x = lvec_operand(a->cell[0], dbl, &xo);
+    void* y = lvec_operand(a->cell[1], dbl, &yo);
+
+    /* x < y is y > x */
+    int ge = (op == LOP_GE || op == LOP_LE);
+    if (op == LOP_LT || op == LOP_LE) {
+        void* t = x; x = y; y = t;
+        int ts = xs; xs = ys; ys = ts;
+    }
+
+    lvec* r = lvec_new(0, n);
+    if (dbl) {
+        lvec_cmp_dbl(ge, r->i, x, y, n, xs, ys);
+    } else {
+        lvec_cmp_int(ge, r->i, x, y, n, xs, ys);
+    }
+    lval_del(a);
+    return lval_vec(r);
+}
+
+// sum or product of the one vector in "a"
+lval* lvec_reduce(lval* a, int op) {
+    lvec* x = a->cell[0]->vec;
+    lval* r;
+    long n;
+    if (x->dbl) {
+        r = lval_dbl(lvec_fold_dbl(op, x->f, x->count));
+    } else if (!(op == LOP_ADD ? lvec_sum_int(x->i, x->count, &n) : lvec_product_int(x->i, x->count, &n))) {
+        r = lval_num(n);
+    } else {
+        /* Totals beyond a long are left to '+' and '*' to become bignums */
+        lval* args = lval_sexpr();
+        lval_reserve(args, 0, x->count);
+        for (int i = 0; i < x->count; i++) { lval_add(args, lval_num(x->i[i])); }
+        r = builtin_op(NULL, args, op);
+    }
+    lval_del(a);
+    return r;
+}
+
+// pack a list of numbers into a vector, of doubles if any of them is a float
+lval* builtin_vec(lenv* e, lval* a) {
+    LASSERT_NUM("vec", a, 1);
+    LASSERT_TYPE("vec", a, 0, LVAL_QEXPR);
+
+    lval* l = a->cell[0];
+    int dbl = 0;
+    for (int i = 0; i < l->count; i++) {
+        int t = lval_type(l->cell[i]);
+        LASSERT(a, t == LVAL_NUM || t == LVAL_DBL,
+            "Function 'vec' passed a list holding a %s. Expected %s or %s.", ltype_name(t), ltype_name(LVAL_NUM), ltype_name(LVAL_DBL));
+        if (t == LVAL_DBL) { dbl = 1; }
+    }
+
+    lvec* x = lvec_new(dbl, l->count);
+    for (int i = 0; i < l->count; i++) {
+        if (dbl) { x->f[i] = lnum_double(l->cell[i]); } else { x->i[i] = lval_int(l->cell[i]); }
+    }
+    lval_del(a);
+    return lval_vec(x);
+}
+
+// elements of a vector as a list
+lval* builtin_vec_list(lenv* e, lval* a) {
+    LASSERT_NUM("vec-list", a, 1);
+    LASSERT_TYPE("vec-list", a, 0, LVAL_VEC);
+
+    lvec* x = a->cell[0]->vec;
+    lval* l = lval_qexpr();
+    lval_reserve(l, 0, x->count);
+    for (int i = 0; i < x->count; i++) {
+        lval_add(l, x->dbl ? lval_dbl(x->f[i]) : lval_num(x->i[i]));
+    }
+    lval_del(a);
+    return l;
+}
+
+lval* builtin_is_vec(lenv* e, lval* a) {
+    LASSERT_NUM("is-vec", a, 1);
+    lval* r = lval_num(lval_type(a->cell[0]) == LVAL_VEC);
+    lval_del(a);
+    return r;
+}
+
+// dot product of two vectors of the same length
+lval* builtin_dot(lenv* e, lval* a) {
+    LASSERT_NUM("dot", a, 2);
+    LASSERT_TYPE("dot", a, 0, LVAL_VEC);
+    LASSERT_TYPE("dot", a, 1, LVAL_VEC);
+    int n = lvec_len(a);
+    LASSERT_VEC_LEN("dot", a, n);
+
+    int dbl = a->cell[0]->vec->dbl || a->cell[1]->vec->dbl;
+    lvec_one xo, yo;
+    void* x = lvec_operand(a->cell[0], dbl, &xo);
+    void* y = lvec_operand(a->cell[1], dbl, &yo);
+
+    long s;
+    lval* r;
+    if (dbl) {
+        r = lval_dbl(lvec_dot_dbl(x, y, n));
+    } else if (!lvec_dot_int(x, y, n, &s)) {
+        r = lval_num(s);
+    } else {
+        /* Totals beyond a long are left to '+' and '*' to become bignums */
+        lval* args = lval_sexpr();
+        lval_reserve(args, 0, n);
+        for (int i = 0; i < n; i++) {
+            lval* p = lval_add(lval_add(lval_sexpr(), lval_num(((long*)x)[i])), lval_num(((long*)y)[i]));
+            lval_add(args, builtin_op(e, p, LOP_MUL));
+        }
+        r = builtin_op(e, args, LOP_ADD);
+    }
+    lval_del(a);
+    return r;
+}
+
+// smallest or largest element of a vector, or of the numbers given
+lval* builtin_extreme(lenv* e, lval* a, char* func, int max) {
+    if (a->count == 1 && lval_type(a->cell[0]) == LVAL_VEC) {
+        lvec* x = a->cell[0]->vec;
+        LASSERT(a, x->count > 0, "Function '%s' passed an empty vector.", func);
+        lval* r = x->dbl ? lval_dbl(lvec_extreme_dbl(max, x->f, x->count))
+                         : lval_num(lvec_extreme_int(max, x->i, x->count));
+        lval_del(a);
+        return r;
+    }
+
+    LASSERT(a, a->count > 0, "Function '%s' passed no arguments.", func);
+    int best = 0;
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_NUMBER(func, a, i);
+        int c = lnum_cmp(a->cell[i], a->cell[best]);
+        if (max ? c > 0 : c < 0) { best = i; }
+    }
+    return lval_take(a, best);
+}
+
+lval* builtin_min(lenv* e, lval* a) {
+    return builtin_extreme(e, a, "min", 0);
+}
+
+lval* builtin_max(lenv* e, lval* a) {
+    return builtin_extreme(e, a, "max", 1);
+}
+
+/* Matrices */
+
+/* Transposes go by square tiles, and multiplies by blocks of rows of "a" */
+/* against blocks of rows and columns of "b" that stay in cache meanwhile */
+#define LMAT_TILE 32
+#define LMAT_BLOCK_I 64
+#define LMAT_BLOCK_K 64
+#define LMAT_BLOCK_J 512
+
+// transpose of "m"
+lmat* lmat_transpose(lmat* m) {
+    lmat* t = lmat_new(m->cols, m->rows);
+    for (int i0 = 0; i0 < m->rows; i0 += LMAT_TILE) {
+        for (int j0 = 0; j0 < m->cols; j0 += LMAT_TILE) {
+            int i1 = i0 + LMAT_TILE < m->rows ? i0 + LMAT_TILE : m->rows;
+            int j1 = j0 + LMAT_TILE < m->cols ? j0 + LMAT_TILE : m->cols;
+            for (int i = i0; i < i1; i++) {
+                for (int j = j0; j < j1; j++) {
+                    t->d[(size_t)j * m->rows + i] = m->d[(size_t)i * m->cols + j];
+                }
+            }
+        }
+    }
+    return t;
+}
+
+// rows "from" up to "to" of c += a * b
+// each row of "c" takes four rows of "b" per pass, still adding them in order of "k"
+void lmat_mul_rows(lmat* c, lmat* a, lmat* b, int from, int to) {
+    int n = a->cols, m = b->cols;
+    for (int i0 = from; i0 < to; i0 += LMAT_BLOCK_I) {
+        int i1 = i0 + LMAT_BLOCK_I < to ? i0 + LMAT_BLOCK_I : to;
+        for (int k0 = 0; k0 < n; k0 += LMAT_BLOCK_K) {
+            int k1 = k0 + LMAT_BLOCK_K < n ? k0 + LMAT_BLOCK_K : n;
+            for (int j0 = 0; j0 < m; j0 += LMAT_BLOCK_J) {
+                int j1 = j0 + LMAT_BLOCK_J < m ? j0 + LMAT_BLOCK_J : m;
+
+                for (int i = i0; i < i1; i++) {
+                    double* cr = c->d + (size_t)i * m;
+                    double* ar = a->d + (size_t)i * n;
+                    int k = k0;
+                    for (; k + 4 <= k1; k += 4) {
+                        double* b0 = b->d + (size_t)k * m;
+                        double* b1 = b0 + m;
+                        double* b2 = b1 + m;
+                        double* b3 = b2 + m;
+                        int j = j0;
+#ifdef LVEC_LANES
+                        lvec_pd x0 = lvec_set1_pd(ar[k]), x1 = lvec_set1_pd(ar[k+1]);
+                        lvec_pd x2 = lvec_set1_pd(ar[k+2]), x3 = lvec_set1_pd(ar[k+3]);
+                        for (; j + LVEC_LANES <= j1; j += LVEC_LANES) {
+                            lvec_pd s = lvec_load_pd(cr + j);
+                            s = lvec_add_pd(s, lvec_mul_pd(x0, lvec_load_pd(b0 + j)));
+                            s = lvec_add_pd(s, lvec_mul_pd(x1, lvec_load_pd(b1 + j)));
+                            s = lvec_add_pd(s, lvec_mul_pd(x2, lvec_load_pd(b2 + j)));
+                            s = lvec_add_pd(s, lvec_mul_pd(x3, lvec_load_pd(b3 + j)));
+                            lvec_store_pd(cr + j, s);
+                        }
+#endif
+                        for (; j < j1; j++) {
+                            double s = cr[j];
+                            s += ar[k] * b0[j];
+                            s += ar[k+1] * b1[j];
+                            s += ar[k+2] * b2[j];
+                            s += ar[k+3] * b3[j];
+                            cr[j] = s;
+                        }
+                    }
+                    for (; k < k1; k++) {
+                        double* br = b->d + (size_t)k * m;
+                        for (int j = j0; j < j1; j++) { cr[j] += ar[k] * br[j]; }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#ifdef LISPY_THREADS
+/* Band of rows of a product for one thread */
+typedef struct {
+    lmat* c;
+    lmat* a;
+    lmat* b;
+    int from;
+    int to;
+} lmat_job;
+
+void* lmat_mul_job(void* p) {
+    lmat_job* job = p;
+    lmat_mul_rows(job->c, job->a, job->b, job->from, job->to);
+    return NULL;
+}
+#endif
+
+// product of "a" and "b", whose inner sizes agree
+lmat* lmat_mul(lmat* a, lmat* b) {
+    lmat* c = lmat_new(a->rows, b->cols);
+
+#ifdef LISPY_THREADS
+    /* Up to --threads bands of at least a block of rows each, for products worth the threads */
+    int t = lispy_threads < a->rows / LMAT_BLOCK_I ? lispy_threads : a->rows / LMAT_BLOCK_I;
+    if (t > 1 && (double)a->rows * a->cols * b->cols >= 1e6) {
+        pthread_t* ids = malloc(sizeof(pthread_t) * t);
+        lmat_job* jobs = malloc(sizeof(lmat_job) * t);
+        int* started = calloc(t, sizeof(int));
+        for (int k = 0; k < t; k++) {
+            jobs[k] = (lmat_job){ c, a, b, (int)((long)a->rows * k / t), (int)((long)a->rows * (k + 1) / t) };
+        }
+        /* A band whose thread cannot be started is done here instead */
+        for (int k = 1; k < t; k++) {
+            started[k] = pthread_create(&ids[k], NULL, lmat_mul_job, &jobs[k]) == 0;
+        }
+        for (int k = 0; k < t; k++) {
+            if (!started[k]) { lmat_mul_job(&jobs[k]); }
+        }
+        for (int k = 1; k < t; k++) {
+            if (started[k]) { pthread_join(ids[k], NULL); }
+        }
+        free(ids); free(jobs); free(started);
+        return c;
+    }
+#endif
+
+    lmat_mul_rows(c, a, b, 0, a->rows);
+    return c;
+}
+
+// storage of matrix argument "v" to write a result into, its own when no copy shares it
+lmat* lmat_result(lval* v) {
+    if (v->mat->refs == 1) {
+        v->mat->refs++;
+        return v->mat;
+    }
+    return lmat_new(v->mat->rows, v->mat->cols);
+}
+
+// check a rows by cols shape fits in memory indices
+#define LASSERT_SHAPE(func, args, rows, cols) \
+    LASSERT(args, rows >= 0 && cols >= 0 && (double)rows * cols <= INT_MAX, \
+        "Function '%s' passed a shape of %li by %li.", func, (long)rows, (long)cols)
+
+// matrix from a list of rows, each a list of as many numbers
+lval* builtin_mat(lenv* e, lval* a) {
+    LASSERT_NUM("mat", a, 1);
+    LASSERT_TYPE("mat", a, 0, LVAL_QEXPR);
+
+    lval* l = a->cell[0];
+    int cols = 0;
+    for (int i = 0; i < l->count; i++) {
+        lval* row = l->cell[i];
+        LASSERT(a, lval_type(row) == LVAL_QEXPR,
+            "Function 'mat' passed a row that is a %s. Expected %s.", ltype_name(lval_type(row)), ltype_name(LVAL_QEXPR));
+        if (i == 0) { cols = row->count; }
+        LASSERT(a, row->count == cols,
+            "Function 'mat' passed rows of %i and %i elements.", cols, row->count);
+        for (int j = 0; j < cols; j++) {
+            LASSERT(a, lval_is_number(row->cell[j]),
+                "Function 'mat' passed a row holding a %s. Expected %s.", ltype_name(lval_type(row->cell[j])), ltype_name(LVAL_NUM));
+        }
+    }
+    LASSERT_SHAPE("mat", a, l->count, cols);
+
+    lmat* m = lmat_new(l->count, cols);
+    for (int i = 0; i < l->count; i++) {
+        for (int j = 0; j < cols; j++) {
+            m->d[(size_t)i * cols + j] = lnum_double(l->cell[i]->cell[j]);
+        }
+    }
+    lval_del(a);
+    return lval_mat(m);
+}
+
+// rows by cols matrix of one number
+lval* builtin_mat_fill(lenv* e, lval* a) {
+    LASSERT_NUM("mat-fill", a, 3);
+    LASSERT_TYPE("mat-fill", a, 0, LVAL_NUM);
+    LASSERT_TYPE("mat-fill", a, 1, LVAL_NUM);
+    LASSERT_NUMBER("mat-fill", a, 2);
+
+    long rows = lval_int(a->cell[0]), cols = lval_int(a->cell[1]);
+    LASSERT_SHAPE("mat-fill", a, rows, cols);
+
+    lmat* m = lmat_new(rows, cols);
+    double x = lnum_double(a->cell[2]);
+    for (size_t i = 0; i < (size_t)rows * cols; i++) { m->d[i] = x; }
+    lval_del(a);
+    return lval_mat(m);
+}
+
+// rows of a matrix as a list of lists
+lval* builtin_mat_list(lenv* e, lval* a) {
+    LASSERT_NUM("mat-list", a, 1);
+    LASSERT_TYPE("mat-list", a, 0, LVAL_MAT);
+
+    lmat* m = a->cell[0]->mat;
+    lval* l = lval_qexpr();
+    lval_reserve(l, 0, m->rows);
+    for (int i = 0; i < m->rows; i++) {
+        lval* row = lval_qexpr();
+        lval_reserve(row, 0, m->cols);
+        for (int j = 0; j < m->cols; j++) { lval_add(row, lval_dbl(m->d[(size_t)i * m->cols + j])); }
+        lval_add(l, row);
+    }
+    lval_del(a);
+    return l;
+}
+
+// element in row i and column j, counting from 0 as 'nth' does
+lval* builtin_mat_get(lenv* e, lval* a) {
+    LASSERT_NUM("mat-get", a, 3);
+    LASSERT_TYPE("mat-get", a, 0, LVAL_NUM);
+    LASSERT_TYPE("mat-get", a, 1, LVAL_NUM);
+    LASSERT_TYPE("mat-get", a, 2, LVAL_MAT);
+
+    lmat* m = a->cell[2]->mat;
+    long i = lval_int(a->cell[0]), j = lval_int(a->cell[1]);
+    LASSERT(a, i >= 0 && i < m->rows && j >= 0 && j < m->cols,
+        "Function 'mat-get' passed index %li %li for a matrix of %i by %i.", i, j, m->rows, m->cols);
+
+    lval* x = lval_dbl(m->d[(size_t)i * m->cols + j]);
+    lval_del(a);
+    return x;
+}
+
+// rows and columns of a matrix
+lval* builtin_mat_shape(lenv* e, lval* a) {
+    LASSERT_NUM("mat-shape", a, 1);
+    LASSERT_TYPE("mat-shape", a, 0, LVAL_MAT);
+
+    lmat* m = a->cell[0]->mat;
+    lval* x = lval_add(lval_add(lval_qexpr(), lval_num(m->rows)), lval_num(m->cols));
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_transpose(lenv* e, lval* a) {
+    LASSERT_NUM("transpose", a, 1);
+    LASSERT_TYPE("transpose", a, 0, LVAL_MAT);
+
+    lmat* t = lmat_transpose(a->cell[0]->mat);
+    lval_del(a);
+    return lval_mat(t);
+}
+
+// sum of matrices of the same shape
+lval* builtin_mat_add(lenv* e, lval* a) {
+    LASSERT(a, a->count > 0, "Function 'mat-add' passed no arguments.");
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_TYPE("mat-add", a, i, LVAL_MAT);
+        lmat* x = a->cell[0]->mat;
+        lmat* y = a->cell[i]->mat;
+        LASSERT(a, x->rows == y->rows && x->cols == y->cols,
+            "Function 'mat-add' passed matrices of %i by %i and %i by %i.", x->rows, x->cols, y->rows, y->cols);
+    }
+
+    lmat* r = lmat_result(a->cell[0]);
+    if (r != a->cell[0]->mat) { memcpy(r->d, a->cell[0]->mat->d, sizeof(double) * r->rows * r->cols); }
+    for (int i = 1; i < a->count; i++) {
+        lvec_kern_dbl(LOP_ADD, r->d, r->d, a->cell[i]->mat->d, r->rows * r->cols, 0, 0);
+    }
+    lval_del(a);
+    return lval_mat(r);
+}
+
+// matrix times a number
+lval* builtin_mat_scale(lenv* e, lval* a) {
+    LASSERT_NUM("mat-scale", a, 2);
+    LASSERT_NUMBER("mat-scale", a, 0);
+    LASSERT_TYPE("mat-scale", a, 1, LVAL_MAT);
+
+    double x = lnum_double(a->cell[0]);
+    lmat* r = lmat_result(a->cell[1]);
+    lvec_kern_dbl(LOP_MUL, r->d, &x, a->cell[1]->mat->d, r->rows * r->cols, 1, 0);
+    lval_del(a);
+    return lval_mat(r);
+}
+
+// matrix product
+lval* builtin_mat_mul(lenv* e, lval* a) {
+    LASSERT_NUM("mat-mul", a, 2);
+    LASSERT_TYPE("mat-mul", a, 0, LVAL_MAT);
+    LASSERT_TYPE("mat-mul", a, 1, LVAL_MAT);
+
+    lmat* x = a->cell[0]->mat;
+    lmat* y = a->cell[1]->mat;
+    LASSERT(a, x->cols == y->rows,
+        "Function 'mat-mul' passed matrices of %i by %i and %i by %i.", x->rows, x->cols, y->rows, y->cols);
+    LASSERT_SHAPE("mat-mul", a, x->rows, y->cols);
+
+    lmat* r = lmat_mul(x, y);
+    lval_del(a);
+    return lval_mat(r);
+}
+
+/* Persistent Maps */
+
+/* Maps are hash array mapped tries, each level taking 5 more bits of a key's hash */
+/* to pick one of 32 slots, holding either a key and its value or a node further down */
+/* Changing a map copies only the nodes on the way to the key, the rest stay shared */
+#define LMAP_BITS 5
+#define LMAP_SLOT(h, shift) (1u << (((h) >> (shift)) & 31))
+
+/* Levels of nested lists a key is hashed through, deeper elements count for nothing */
+#define LMAP_HASH_DEPTH 4
+
+int lval_eq(lval* x, lval* y);
+
+// number of bits set in "x"
+int lmap_popcount(uint32_t x) {
+#ifdef __GNUC__
+    return __builtin_popcount(x);
+#else
+    int n = 0;
+    for (; x; x &= x - 1) { n++; }
+    return n;
+#endif
+}
+
+// position among the entries of "bits" of the entry for "slot"
+int lmap_index(uint32_t bits, uint32_t slot) {
+    return lmap_popcount(bits & (slot - 1));
+}
+
+// node with room for "count" pairs and "subs" nodes below, its entries left to the caller
+lmap* lmap_new(int count, int subs) {
+    lmap* n = malloc(sizeof(lmap) + sizeof(lval*) * 2 * count + sizeof(lmap*) * subs);
+    n->refs = 1;
+    n->mark = lgc.epoch;
+    n->size = 0;
+    n->pairs = 0;
+    n->nodes = 0;
+    n->count = count;
+    n->sub = (lmap**)&n->kv[2 * count];
+    return n;
+}
+
+// trace a node and those below it, unless this collection already has
+void lmap_shade(lmap* n) {
+    if (lgc.phase != LGC_MARK || n->mark == lgc.epoch) { return; }
+    n->mark = lgc.epoch;
+    for (int i = 0; i < 2 * n->count; i++) { lgc_shade(n->kv[i]); }
+    for (int i = 0; i < lmap_popcount(n->nodes); i++) { lmap_shade(n->sub[i]); }
+}
+
+// store a key and value, or a node below, traced if "n" already was
+void lmap_set_pair(lmap* n, int i, lval* k, lval* v) {
+    n->kv[2*i] = k;
+    n->kv[2*i+1] = v;
+    lgc_shade(k);
+    lgc_shade(v);
+}
+
+void lmap_set_sub(lmap* n, int i, lmap* s) {
+    n->sub[i] = s;
+    lmap_shade(s);
+}
+
+// drop a reference to a node, deleting its keys and values with it
+void lmap_del(lmap* n) {
+    if (--n->refs > 0) { return; }
+    for (int i = 0; i < 2 * n->count; i++) { lval_del(n->kv[i]); }
+    for (int i = 0; i < lmap_popcount(n->nodes); i++) { lmap_del(n->sub[i]); }
+    free(n);
+}
+
+// drop a reference to a node only unreachable lvals refer to, they are swept separately
+void lmap_release(lmap* n) {
+    if (--n->refs > 0) { return; }
+    for (int i = 0; i < lmap_popcount(n->nodes); i++) { lmap_release(n->sub[i]); }
+    free(n);
+}
+
+/* Construct a pointer to a new Map lval */
+lval* lval_map(lmap* n) {
+    lval* v = lval_alloc();
+    v->type = LVAL_MAP;
+    v->map = n;
+    return v;
+}
 
-    /* Compare Based upon type */
-    switch (x->type) {
-        /* Compare Number Value */
-        case LVAL_NUM: return (x->num == y->num);
+// mix the bits of "x" so each of them moves every bit of the hash
+uint32_t lmap_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+// hash of a bignum, over its limbs so that no two nearby ones collide
+uint32_t lmap_hash_big(lbig* b) {
+    uint64_t h = b->neg;
+    for (int i = 0; i < b->size; i++) { h = h * 31 + b->d[i]; }
+    return lmap_mix(h ^ (h >> 32) ^ 0x9e3779b97f4a7c15ULL);
+}
+
+// hash of a double, a whole one hashing as the integer lval_eq finds it equal to
+uint32_t lmap_hash_dbl(double d) {
+    if (isfinite(d) && d == trunc(d)) {
+        /* -0.0 is whole too, and hashes as 0 */
+        if (d >= (double)LONG_MIN && d < -(double)LONG_MIN) { return lmap_mix((uint64_t)(long)d); }
+        lbig* b = lbig_from_double(d);
+        uint32_t h = lmap_hash_big(b);
+        free(b);
+        return h;
+    }
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return lmap_mix(bits);
+}
 
-        /* Compare String Values */
-        case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
-        case LVAL_STR: return (strcmp(x->str, y->str) == 0);
+int lmap_pairs(lmap* n, lval** out);
+
+// hash of "v", equal for any two values lval_eq finds equal
+uint32_t lval_hash(lval* v, int depth) {
+    uint64_t h = lval_type(v);
+    switch (lval_type(v)) {
+        case LVAL_NUM: return lmap_mix((uint64_t)lval_int(v));
+        case LVAL_BIG: return lmap_hash_big(v->big);
+        case LVAL_DBL: return lmap_hash_dbl(v->dbl);
+        case LVAL_ERR: return lmap_mix(h + lsym_hash(v->err));
+        case LVAL_SYM: return lmap_mix(h + lsym_hash(v->sym));
+        case LVAL_STR: return lmap_mix(h + lsym_hash(v->str));
+        case LVAL_VEC:
+            for (int i = 0; i < v->vec->count; i++) {
+                h = h * 31 + (v->vec->dbl ? lmap_hash_dbl(v->vec->f[i]) : lmap_mix((uint64_t)v->vec->i[i]));
+            }
+            return lmap_mix(h);
+        case LVAL_MAT:
+            h = h * 31 + v->mat->rows;
+            for (size_t i = 0; i < (size_t)v->mat->rows * v->mat->cols; i++) { h = h * 31 + lmap_hash_dbl(v->mat->d[i]); }
+            return lmap_mix(h);
 
-        /* If builtin compare, otherwise compare foramls and body */
+        /* Builtins all hash alike, so keys come out in the same order every run */
         case LVAL_FUN:
-            if (x->builtin || y->builtin) {
-                return x->builtin == y->builtin;
-            } else {
-                return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
+            if (!v->builtin) {
+                lval rest = lval_formals_left(v);
+                h = h * 31 + lval_hash(&rest, depth);
+                h = h * 31 + lval_hash(v->body, depth);
             }
-        
-        /* If list compare every individual element */
-        case LVAL_QEXPR:
+            return lmap_mix(h);
+
         case LVAL_SEXPR:
-            if (x->count != y->count) { return 0; }
-            for (int i = 0; i < x->count; i++) {
-                /* If any element not equal then whole list not equal */
-                if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
+        case LVAL_QEXPR:
+            h = h * 31 + v->count;
+            for (int i = 0; depth && i < v->count; i++) { h = h * 31 + lval_hash(v->cell[i], depth - 1); }
+            return lmap_mix(h);
+
+        /* Pairs are added up, as maps holding the same pairs may hold them in any order */
+        case LVAL_MAP: {
+            h = h * 31 + v->map->size;
+            if (!depth) { return lmap_mix(h); }
+            lval** p = malloc(sizeof(lval*) * 2 * v->map->size + 1);
+            lmap_pairs(v->map, p);
+            for (int i = 0; i < v->map->size; i++) {
+                h += lmap_mix((uint64_t)lval_hash(p[2*i], depth - 1) * 31 + lval_hash(p[2*i+1], depth - 1));
             }
-            /* Otherwise lists must be equal */
-            return 1;
-            break;
+            free(p);
+            return lmap_mix(h);
+        }
     }
-    return 0;
+    return lmap_mix(h);
 }
 
-// comparing
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    int r;
-    if (strcmp(op, "==") == 0) {
-        r = lval_eq(a->cell[0], a->cell[1]);
+// keys and values held under "n" into "out", alternating, returning how many were written
+int lmap_pairs(lmap* n, lval** out) {
+    memcpy(out, n->kv, sizeof(lval*) * 2 * n->count);
+    int w = 2 * n->count;
+    for (int i = 0; i < lmap_popcount(n->nodes); i++) { w += lmap_pairs(n->sub[i], out + w); }
+    return w;
+}
+
+// value bound to "k" under "n", NULL when there is none
+lval* lmap_get(lmap* n, uint32_t h, lval* k) {
+    for (int shift = 0; ; shift += LMAP_BITS) {
+
+        /* Past the last bits of hash every key is compared in turn */
+        if (shift >= 32) {
+            for (int i = 0; i < n->count; i++) {
+                if (lval_eq(n->kv[2*i], k)) { return n->kv[2*i+1]; }
+            }
+            return NULL;
+        }
+
+        uint32_t slot = LMAP_SLOT(h, shift);
+        if (n->pairs & slot) {
+            int i = lmap_index(n->pairs, slot);
+            return lval_eq(n->kv[2*i], k) ? n->kv[2*i+1] : NULL;
+        }
+        if (!(n->nodes & slot)) { return NULL; }
+        n = n->sub[lmap_index(n->nodes, slot)];
+    }
+}
+
+// "n" for the caller to change, copied first if another map shares it
+lmap* lmap_own(lmap* n) {
+    if (n->refs == 1) { return n; }
+    int subs = lmap_popcount(n->nodes);
+    lmap* c = lmap_new(n->count, subs);
+    c->size = n->size;
+    c->pairs = n->pairs;
+    c->nodes = n->nodes;
+    for (int i = 0; i < n->count; i++) { lmap_set_pair(c, i, lval_copy(n->kv[2*i]), lval_copy(n->kv[2*i+1])); }
+    for (int i = 0; i < subs; i++) { n->sub[i]->refs++; lmap_set_sub(c, i, n->sub[i]); }
+    n->refs--;
+    return c;
+}
+
+// unshared node "n" given the slots "pairs" and "nodes" instead
+// entries of slots both have move across, those of new slots are left to the caller
+lmap* lmap_reslot(lmap* n, uint32_t pairs, uint32_t nodes) {
+    lmap* r = lmap_new(lmap_popcount(pairs), lmap_popcount(nodes));
+    r->size = n->size;
+    r->pairs = pairs;
+    r->nodes = nodes;
+    for (uint32_t bits = pairs; bits; bits &= bits - 1) {
+        uint32_t slot = bits & -bits;
+        if (n->pairs & slot) {
+            int i = lmap_index(n->pairs, slot);
+            lmap_set_pair(r, lmap_index(pairs, slot), n->kv[2*i], n->kv[2*i+1]);
+        }
+    }
+    for (uint32_t bits = nodes; bits; bits &= bits - 1) {
+        uint32_t slot = bits & -bits;
+        if (n->nodes & slot) { lmap_set_sub(r, lmap_index(nodes, slot), n->sub[lmap_index(n->nodes, slot)]); }
+    }
+    free(n);
+    return r;
+}
+
+// node holding just two keys with their values, their hashes agreeing below "shift"
+lmap* lmap_pair2(int shift, uint32_t h1, lval* k1, lval* v1, uint32_t h2, lval* k2, lval* v2) {
+    lmap* n;
+    if (shift >= 32) {
+        n = lmap_new(2, 0);
+        lmap_set_pair(n, 0, k1, v1);
+        lmap_set_pair(n, 1, k2, v2);
+    } else if (LMAP_SLOT(h1, shift) == LMAP_SLOT(h2, shift)) {
+        /* Hashes still agree here, so both go further down */
+        n = lmap_new(0, 1);
+        n->nodes = LMAP_SLOT(h1, shift);
+        lmap_set_sub(n, 0, lmap_pair2(shift + LMAP_BITS, h1, k1, v1, h2, k2, v2));
+    } else {
+        n = lmap_new(2, 0);
+        n->pairs = LMAP_SLOT(h1, shift) | LMAP_SLOT(h2, shift);
+        int first = LMAP_SLOT(h1, shift) < LMAP_SLOT(h2, shift) ? 0 : 1;
+        lmap_set_pair(n, first, k1, v1);
+        lmap_set_pair(n, 1 - first, k2, v2);
+    }
+    n->size = 2;
+    return n;
+}
+
+// node "n" with "k" bound to "v", taking over all three; "h" is the hash of "k"
+// a key already there keeps its place and gets the new value
+lmap* lmap_put(lmap* n, int shift, uint32_t h, lval* k, lval* v) {
+    n = lmap_own(n);
+
+    /* Past the last bits of hash a new key goes on the end */
+    if (shift >= 32) {
+        for (int i = 0; i < n->count; i++) {
+            if (lval_eq(n->kv[2*i], k)) {
+                lval_del(k);
+                lval_del(n->kv[2*i+1]);
+                lmap_set_pair(n, i, n->kv[2*i], v);
+                return n;
+            }
+        }
+        lmap* r = lmap_new(n->count + 1, 0);
+        r->size = n->size + 1;
+        for (int i = 0; i < n->count; i++) { lmap_set_pair(r, i, n->kv[2*i], n->kv[2*i+1]); }
+        lmap_set_pair(r, n->count, k, v);
+        free(n);
+        return r;
+    }
+
+    uint32_t slot = LMAP_SLOT(h, shift);
+
+    /* A node already there takes the key */
+    if (n->nodes & slot) {
+        int i = lmap_index(n->nodes, slot);
+        int before = n->sub[i]->size;
+        lmap* s = lmap_put(n->sub[i], shift + LMAP_BITS, h, k, v);
+        n->size += s->size - before;
+        lmap_set_sub(n, i, s);
+        return n;
+    }
+
+    if (n->pairs & slot) {
+        int i = lmap_index(n->pairs, slot);
+        lval* k2 = n->kv[2*i];
+        lval* v2 = n->kv[2*i+1];
+        if (lval_eq(k2, k)) {
+            lval_del(k);
+            lval_del(v2);
+            lmap_set_pair(n, i, k2, v);
+            return n;
+        }
+
+        /* Two keys wanting the slot move down into a node of their own */
+        lmap* s = lmap_pair2(shift + LMAP_BITS, lval_hash(k2, LMAP_HASH_DEPTH), k2, v2, h, k, v);
+        n = lmap_reslot(n, n->pairs & ~slot, n->nodes | slot);
+        n->size++;
+        lmap_set_sub(n, lmap_index(n->nodes, slot), s);
+        return n;
+    }
+
+    n = lmap_reslot(n, n->pairs | slot, n->nodes);
+    n->size++;
+    lmap_set_pair(n, lmap_index(n->pairs, slot), k, v);
+    return n;
+}
+
+// node "n" without "k", which must be under it; "h" is the hash of "k"
+// a node below left with one key gives it up to "n", so nodes below always hold two or more
+lmap* lmap_remove(lmap* n, int shift, uint32_t h, lval* k) {
+    n = lmap_own(n);
+    n->size--;
+
+    if (shift >= 32) {
+        int i = 0;
+        while (!lval_eq(n->kv[2*i], k)) { i++; }
+        lval_del(n->kv[2*i]);
+        lval_del(n->kv[2*i+1]);
+        memmove(&n->kv[2*i], &n->kv[2*i+2], sizeof(lval*) * 2 * (n->count - i - 1));
+        n->count--;
+        return n;
+    }
+
+    uint32_t slot = LMAP_SLOT(h, shift);
+    if (n->pairs & slot) {
+        int i = lmap_index(n->pairs, slot);
+        lval_del(n->kv[2*i]);
+        lval_del(n->kv[2*i+1]);
+        return lmap_reslot(n, n->pairs & ~slot, n->nodes);
     }
-    if (strcmp(op, "!=") == 0) {
-        r = !lval_eq(a->cell[0], a->cell[1]);
+
+    int i = lmap_index(n->nodes, slot);
+    lmap* s = lmap_remove(n->sub[i], shift + LMAP_BITS, h, k);
+    if (s->size > 1) {
+        lmap_set_sub(n, i, s);
+        return n;
+    }
+
+    /* The one key left below moves up into the slot */
+    lval* k2 = s->kv[0];
+    lval* v2 = s->kv[1];
+    free(s);
+    n = lmap_reslot(n, n->pairs | slot, n->nodes & ~slot);
+    lmap_set_pair(n, lmap_index(n->pairs, slot), k2, v2);
+    return n;
+}
+
+// whether two maps bind equal keys to equal values
+int lmap_eq(lmap* x, lmap* y) {
+    if (x == y) { return 1; }
+    if (x->size != y->size) { return 0; }
+
+    lval** p = malloc(sizeof(lval*) * 2 * x->size + 1);
+    lmap_pairs(x, p);
+    int eq = 1;
+    for (int i = 0; eq && i < x->size; i++) {
+        lval* v = lmap_get(y, lval_hash(p[2*i], LMAP_HASH_DEPTH), p[2*i]);
+        eq = v && lval_eq(p[2*i+1], v);
+    }
+    free(p);
+    return eq;
+}
+
+// print a map as its keys and values between #{ and }
+void lval_print_map(lmap* n) {
+    lval** p = malloc(sizeof(lval*) * 2 * n->size + 1);
+    lmap_pairs(n, p);
+    printf("#{");
+    for (int i = 0; i < n->size; i++) {
+        if (i) { printf(", "); }
+        lval_print(p[2*i]);
+        putchar(' ');
+        lval_print(p[2*i+1]);
+    }
+    putchar('}');
+    free(p);
+}
+
+// map of the keys and values of a list, alternating, later keys replacing earlier ones
+lval* builtin_map_new(lenv* e, lval* a) {
+    LASSERT_NUM("map-new", a, 1);
+    LASSERT_TYPE("map-new", a, 0, LVAL_QEXPR);
+    LASSERT(a, a->cell[0]->count % 2 == 0,
+        "Function 'map-new' passed a key without a value.");
+
+    lval* l = lval_take(a, 0);
+    lmap* n = lmap_new(0, 0);
+    while (l->count) {
+        lval* k = lval_pop(l, 0);
+        lval* v = lval_pop(l, 0);
+        n = lmap_put(n, 0, lval_hash(k, LMAP_HASH_DEPTH), k, v);
+    }
+    lval_del(l);
+    return lval_map(n);
+}
+
+// map "m" with "k" bound to "v", as (assoc k v m)
+lval* builtin_assoc(lenv* e, lval* a) {
+    LASSERT_NUM("assoc", a, 3);
+    LASSERT_TYPE("assoc", a, 2, LVAL_MAP);
+
+    lval* m = lval_pop(a, 2);
+    lval* v = lval_pop(a, 1);
+    lval* k = lval_take(a, 0);
+    m->map = lmap_put(m->map, 0, lval_hash(k, LMAP_HASH_DEPTH), k, v);
+    lmap_shade(m->map);
+    return m;
+}
+
+// map "m" without "k", as (dissoc k m)
+lval* builtin_dissoc(lenv* e, lval* a) {
+    LASSERT_NUM("dissoc", a, 2);
+    LASSERT_TYPE("dissoc", a, 1, LVAL_MAP);
+
+    lval* m = lval_pop(a, 1);
+    uint32_t h = lval_hash(a->cell[0], LMAP_HASH_DEPTH);
+    if (lmap_get(m->map, h, a->cell[0])) {
+        m->map = lmap_remove(m->map, 0, h, a->cell[0]);
+        lmap_shade(m->map);
+    }
+    lval_del(a);
+    return m;
+}
+
+// value of "k" in "m", as (get k m), or of a default given after "m" when it has none
+lval* builtin_get(lenv* e, lval* a) {
+    LASSERT(a, a->count == 2 || a->count == 3,
+        "Function 'get' passed incorrect number of arguments. Got %i, Expected 2 or 3.", a->count);
+    LASSERT_TYPE("get", a, 1, LVAL_MAP);
+
+    lval* v = lmap_get(a->cell[1]->map, lval_hash(a->cell[0], LMAP_HASH_DEPTH), a->cell[0]);
+    if (v) {
+        v = lval_copy(v);
+        lval_del(a);
+        return v;
+    }
+    LASSERT(a, a->count == 3, "Function 'get' passed a key the map does not hold.");
+    return lval_take(a, 2);
+}
+
+// whether "m" holds "k", as (contains k m)
+lval* builtin_contains(lenv* e, lval* a) {
+    LASSERT_NUM("contains", a, 2);
+    LASSERT_TYPE("contains", a, 1, LVAL_MAP);
+
+    lval* r = lval_num(lmap_get(a->cell[1]->map, lval_hash(a->cell[0], LMAP_HASH_DEPTH), a->cell[0]) != NULL);
+    lval_del(a);
+    return r;
+}
+
+// keys or values of a map, in the same order for both
+lval* builtin_map_list(lenv* e, lval* a, char* func, int vals) {
+    LASSERT_NUM(func, a, 1);
+    LASSERT_TYPE(func, a, 0, LVAL_MAP);
+
+    lmap* n = a->cell[0]->map;
+    lval** p = malloc(sizeof(lval*) * 2 * n->size + 1);
+    lmap_pairs(n, p);
+    lval* l = lval_qexpr();
+    lval_reserve(l, 0, n->size);
+    for (int i = 0; i < n->size; i++) { lval_add(l, lval_copy(p[2*i + vals])); }
+    free(p);
+    lval_del(a);
+    return l;
+}
+
+lval* builtin_keys(lenv* e, lval* a) {
+    return builtin_map_list(e, a, "keys", 0);
+}
+
+lval* builtin_vals(lenv* e, lval* a) {
+    return builtin_map_list(e, a, "vals", 1);
+}
+
+lval* builtin_size(lenv* e, lval* a) {
+    LASSERT_NUM("size", a, 1);
+    LASSERT_TYPE("size", a, 0, LVAL_MAP);
+    lval* r = lval_num(a->cell[0]->map->size);
+    lval_del(a);
+    return r;
+}
+
+lval* builtin_is_map(lenv* e, lval* a) {
+    LASSERT_NUM("is-map", a, 1);
+    lval* r = lval_num(lval_type(a->cell[0]) == LVAL_MAP);
+    lval_del(a);
+    return r;
+}
+
+// function for equality
+// compare two values, the lists being compared are kept in a stack of their own
+int lval_eq(lval* x, lval* y) {
+
+    /* Pairs of lists whose elements are being compared, "i" of them equal so far */
+    int depth = 0, cap = 0;
+    struct { lval* x; lval* y; int i; }* open = NULL;
+    int eq;
+
+    while (1) {
+
+        /* Different Types are always unequal, but for floats against other numbers */
+        if (lval_type(x) != lval_type(y)) {
+            int tx = lval_type(x), ty = lval_type(y);
+            eq = (tx == LVAL_DBL && (ty == LVAL_NUM || ty == LVAL_BIG))
+              || (ty == LVAL_DBL && (tx == LVAL_NUM || tx == LVAL_BIG));
+            if (eq) { eq = !isnan(tx == LVAL_DBL ? x->dbl : y->dbl) && lnum_cmp(x, y) == 0; }
+            break;
+        }
+
+        /* Compare Based upon type */
+        switch (lval_type(x)) {
+            /* Compare Number Value */
+            case LVAL_NUM: eq = (lval_int(x) == lval_int(y)); break;
+            case LVAL_BIG: eq = (lbig_cmp(x->big, y->big) == 0); break;
+            case LVAL_DBL: eq = (x->dbl == y->dbl); break;
+            case LVAL_VEC: eq = lvec_eq(x->vec, y->vec); break;
+            case LVAL_MAP: eq = lmap_eq(x->map, y->map); break;
+            case LVAL_MAT:
+                eq = x->mat->rows == y->mat->rows && x->mat->cols == y->mat->cols;
+                for (size_t i = 0; eq && i < (size_t)x->mat->rows * x->mat->cols; i++) {
+                    eq = (x->mat->d[i] == y->mat->d[i]);
+                }
+                break;
+
+            /* Compare String Values */
+            case LVAL_ERR: eq = (strcmp(x->err, y->err) == 0); break;
+            case LVAL_SYM: eq = (x->sym == y->sym); break;
+            case LVAL_STR: eq = (strcmp(x->str, y->str) == 0); break;
+
+            /* If builtin compare, otherwise compare formals and then body */
+            case LVAL_FUN:
+                if (x->builtin || y->builtin) {
+                    eq = x->builtin == y->builtin;
+                } else {
+                    lval xr = lval_formals_left(x);
+                    lval yr = lval_formals_left(y);
+                    eq = lval_eq(&xr, &yr);
+                    if (eq) { x = x->body; y = y->body; continue; }
+                }
+                break;
+
+            /* If list compare every individual element */
+            case LVAL_QEXPR:
+            case LVAL_SEXPR:
+                eq = (x->count == y->count);
+                if (eq && x->count) {
+                    if (depth == cap) {
+                        cap = cap ? cap * 2 : 16;
+                        open = realloc(open, sizeof(*open) * cap);
+                    }
+                    open[depth].x = x;
+                    open[depth].y = y;
+                    open[depth].i = 0;
+                    depth++;
+                }
+                break;
+
+            default: eq = 0; break;
+        }
+
+        /* If any element not equal then whole list not equal */
+        if (!eq) { break; }
+
+        /* Otherwise go on to the next pair of elements, lists whose elements all matched are equal */
+        while (depth && open[depth-1].i == open[depth-1].x->count) { depth--; }
+        if (!depth) { break; }
+        x = open[depth-1].x->cell[open[depth-1].i];
+        y = open[depth-1].y->cell[open[depth-1].i++];
     }
+
+    free(open);
+    return eq;
+}
+
+// comparing
+lval* builtin_cmp(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lop_names[op], a, 2);
+    int r = lval_eq(a->cell[0], a->cell[1]);
+    if (op == LOP_NE) { r = !r; }
     lval_del(a);
     return lval_num(r);
 }
 
 lval* builtin_eq(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "==");
+    return builtin_cmp(e, a, LOP_EQ);
 }
 
 lval* builtin_ne(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "!=");
+    return builtin_cmp(e, a, LOP_NE);
 }
 
 // if function
 // get user to pass in result of a comparison, Q-expression for code to be evaluated on true, Q-expression for code to be evaluated on false
-lval* builtin_if(lenv* e, lval* a) {
+// check the arguments to if and return the branch to evaluate
+lval* builtin_if_branch(lval* a) {
     LASSERT_NUM("if", a, 3);
-    LASSERT_TYPE("if", a, 0, LVAL_NUM);
+    LASSERT_NUMBER("if", a, 0);
     LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
     LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
-    /* Mark Both Expressions as evaluable */
     lval* x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
-
-    if (a->cell[0]->num) {
-        /* If condition is true evaluate first expression */
-        x = lval_eval(e, lval_pop(a, 1));
+    if (lnum_true(a->cell[0])) {
+        /* If condition is true take first expression */
+        x = lval_pop(a, 1);
     } else {
-        /* Otherwise evaluate second expression */
-        x = lval_eval(e, lval_pop(a, 2));
+        /* Otherwise take second expression */
+        x = lval_pop(a, 2);
     }
 
-    /* Delete argument list and return */
+    /* Mark the Expression as evaluable, delete argument list and return */
+    x->type = LVAL_SEXPR;
     lval_del(a);
     return x;
 }
 
+lval* builtin_if(lenv* e, lval* a) {
+    lval* x = builtin_if_branch(a);
+    if (lval_type(x) == LVAL_ERR) { return x; }
+    return lval_eval(e, x);
+}
+
 lval* lval_read(mpc_ast_t* t);
+void lgc_root_push(lval* v);
+void lgc_root_pop(void);
+void lgc_safepoint(void);
 
 // function that can load and evaluate a file when passed a string of its name
 lval* builtin_load(lenv* e, lval* a) {
@@ -845,15 +4125,22 @@ lval* builtin_load(lenv* e, lval* a) {
         lval* expr = lval_read(r.output);
         mpc_ast_delete(r.output);
 
+        /* Keep the arguments and remaining expressions alive across collections */
+        lgc_root_push(a);
+        lgc_root_push(expr);
+
          /* Evaluate each Expression */
         while (expr->count) {
             lval* x = lval_eval(e, lval_pop(expr, 0));
              /* If Evaluation leads to error print it */
-            if (x->type == LVAL_ERR) { lval_println(x); }
+            if (lval_type(x) == LVAL_ERR) { lval_println(x); }
             lval_del(x);
+            lgc_safepoint();
         }
 
         /* Delete expressions and arguments */
+        lgc_root_pop();
+        lgc_root_pop();
         lval_del(expr);
         lval_del(a);
 
@@ -903,6 +4190,8 @@ lval* builtin_error(lenv* e, lval* a) {
     return err;
 }
 
+lval* builtin_gc_stats(lenv* e, lval* a);
+
 // register builtins with some environment
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
     lval* k = lval_sym(name);
@@ -918,6 +4207,20 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "tail", builtin_tail);
     lenv_add_builtin(e, "eval", builtin_eval);
     lenv_add_builtin(e, "join", builtin_join);
+    lenv_add_builtin(e, "len", builtin_len);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "last", builtin_last);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "split", builtin_split);
+    lenv_add_builtin(e, "elem", builtin_elem);
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "product", builtin_product);
+    lenv_add_builtin(e, "init", builtin_init);
+    lenv_add_builtin(e, "reverse", builtin_reverse);
 
     /* Mathematical Functions */
     lenv_add_builtin(e, "+", builtin_add);
@@ -926,6 +4229,37 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "/", builtin_div);
     lenv_add_builtin(e, "%", builtin_mod);
     lenv_add_builtin(e, "^", builtin_exp);
+    lenv_add_builtin(e, "powmod", builtin_powmod);
+    lenv_add_builtin(e, "min", builtin_min);
+    lenv_add_builtin(e, "max", builtin_max);
+
+    /* Vector Functions */
+    lenv_add_builtin(e, "vec", builtin_vec);
+    lenv_add_builtin(e, "vec-list", builtin_vec_list);
+    lenv_add_builtin(e, "is-vec", builtin_is_vec);
+    lenv_add_builtin(e, "dot", builtin_dot);
+
+    /* Matrix Functions */
+    lenv_add_builtin(e, "mat", builtin_mat);
+    lenv_add_builtin(e, "mat-fill", builtin_mat_fill);
+    lenv_add_builtin(e, "mat-list", builtin_mat_list);
+    lenv_add_builtin(e, "mat-get", builtin_mat_get);
+    lenv_add_builtin(e, "mat-shape", builtin_mat_shape);
+    lenv_add_builtin(e, "transpose", builtin_transpose);
+    lenv_add_builtin(e, "mat-add", builtin_mat_add);
+    lenv_add_builtin(e, "mat-scale", builtin_mat_scale);
+    lenv_add_builtin(e, "mat-mul", builtin_mat_mul);
+
+    /* Map Functions */
+    lenv_add_builtin(e, "map-new", builtin_map_new);
+    lenv_add_builtin(e, "assoc", builtin_assoc);
+    lenv_add_builtin(e, "dissoc", builtin_dissoc);
+    lenv_add_builtin(e, "get", builtin_get);
+    lenv_add_builtin(e, "contains", builtin_contains);
+    lenv_add_builtin(e, "keys", builtin_keys);
+    lenv_add_builtin(e, "vals", builtin_vals);
+    lenv_add_builtin(e, "size", builtin_size);
+    lenv_add_builtin(e, "is-map", builtin_is_map);
 
     /* Variable Functions */
     lenv_add_builtin(e, "def", builtin_def);
@@ -946,6 +4280,15 @@ void lenv_add_builtins(lenv* e) {
     // lenv_add_builtin(e, "load", builtin_load);
     lenv_add_builtin(e, "error", builtin_error);
     lenv_add_builtin(e, "print", builtin_print);
+
+    /* Memory Functions */
+    lenv_add_builtin(e, "gc-stats", builtin_gc_stats);
+
+    /* Lets library.lspy tell whether its own list functions are wanted */
+    lval* k = lval_sym("lispy-prelude");
+    lval* v = lval_num(lispy_prelude);
+    lenv_put(e, k, v);
+    lval_del(k); lval_del(v);
 }
 
 // builtins lookup
@@ -955,157 +4298,896 @@ lval* builtin(lenv* e, lval* a, char* func) {
     if (strcmp("tail", func) == 0) { return builtin_tail(e, a); }
     if (strcmp("join", func) == 0) { return builtin_join(e, a); }
     if (strcmp("eval", func) == 0) { return builtin_eval(e, a); }
-    if (strstr("+-/*%^", func)) { return builtin_op(e, a, func); }
+    for (int op = LOP_ADD; op <= LOP_EXP; op++) {
+        if (strcmp(lop_names[op], func) == 0) { return builtin_op(e, a, op); }
+    }
     lval_del(a);
     return lval_err("Unknown Function!");
 }
 
 // function for when a function is called
+// returns NULL once a lambda is fully bound, leaving its body to be entered by the caller
 lval* lval_call(lenv* e, lval* f, lval* a) {
 
     /* If Builtin then simply apply that */
     if (f->builtin) { return f->builtin(e, a); }
 
+    /* Arguments given earlier take the first formals */
+    lval* formals = f->formals;
+    int bound = f->args ? f->args->count : 0;
+
+    /* Count the formals that must be given before the body can run */
+    int need = 0;
+    while (bound + need < formals->count
+        && strcmp(formals->cell[bound + need]->sym, "&") != 0) {
+        need++;
+    }
+
+    /* With too few the arguments are kept in a partial application */
+    if (a->count < need) {
+        lval* p = lval_copy(f);
+        p->args = lval_join(p->args ? p->args : lval_qexpr(), a);
+        return p;
+    }
+
+    /* Otherwise the function itself is left alone, arguments are moved */
+    /* into a frame with a slot for each formal and those given earlier are */
+    /* lent to it, "f" holds them until the frame is gone */
+    int distinct = f->slots >= 0;
+    lenv* env = lenv_frame(distinct ? f->slots : 0);
+    for (int i = 0; i < bound; i++) {
+        if (distinct) {
+            lenv_lend(env, formals->cell[i]->sym, f->args->cell[i]);
+        } else {
+            lenv_move(env, formals->cell[i]->sym, lval_copy(f->args->cell[i]), 0);
+        }
+    }
+
     /* Record Argument Counts */
     int given = a->count;
-    int total = f->formals->count;
+    int total = formals->count;
 
-    /* While arguments still remain to be processed */
+    /* Formals are bound in order after those already given */
+    int i = bound;
     while (a->count) {
 
         /* If we've run out of formal arguments to bind */
-        if (f->formals->count == 0) {
-            lval_del(a);
-            return lval_err("Function passed too many arguments. Got %i, Expected %i.", given, total);
+        if (i == total) {
+            lenv_del(env); lval_del(a);
+            return lval_err("Function passed too many arguments. Got %i, Expected %i.", given, total - bound);
         }
 
-        /* Pop the first symbol from the formals */
-        lval* sym = lval_pop(f->formals, 0);
-
         /* Special Case to deal with '&' */
-        if (strcmp(sym->sym, "&") == 0) {
+        if (strcmp(formals->cell[i]->sym, "&") == 0) {
 
             /* Ensure '&' is followed by another symbol */
-            if (f->formals->count != 1) {
-                lval_del(a);
+            if (total - i != 2) {
+                lenv_del(env); lval_del(a);
                 return lval_err("Function format invalid. Symbol '&' is not followed by single symbol.");
             }
 
             /* Next format should be bound to remaining arguments */
-            lval* nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym); lval_del(nsym);
+            lenv_move(env, formals->cell[i+1]->sym, builtin_list(e, a), distinct);
+            a = NULL;
+            i += 2;
             break;
         }
 
-        /* Pop the next argument from the list */
-        lval* val = lval_pop(a, 0);
-
-        /* Bind a copy into the function's environment */
-        lenv_put(f->env, sym, val);
-
-        /* Delete symbol and value */
-        lval_del(sym); lval_del(val);
+        /* Move the next argument into the frame */
+        lenv_move(env, formals->cell[i]->sym, lval_pop(a, 0), distinct);
+        i++;
     }
 
     /* Argument list is now bound so can be cleaned up */
-    lval_del(a);
+    if (a) { lval_del(a); }
 
     /* If '&' remains in formal list bind to empty list */
-    if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0) {
+    if (i < total) {
 
         /* Check to ensure that & is not passed in invalidly. */
-        if (f->formals->count != 2) {
+        if (total - i != 2) {
+            lenv_del(env);
             return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
         }
 
-        /* Pop and delete '&' symbol */
-        lval_del(lval_pop(f->formals, 0));
+        lenv_move(env, formals->cell[i+1]->sym, lval_qexpr(), distinct);
+    }
 
-        /* Pop next symbol and create empty list */
-        lval* sym = lval_pop(f->formals, 0);
-        lval* val = lval_qexpr();
+    /* Frames are mostly read by slot, only those too big to recycle are indexed */
+    if (env->count > LENV_POOL && !env->index) { lenv_reindex(env); }
 
-        /* Bind to environment and delete */
-        lenv_put(f->env, sym, val);
-        lval_del(sym); lval_del(val);
-    }
+    /* The body is evaluated in the frame */
+    if (f->env) { lenv_del(f->env); }
+    f->env = env;
+    return NULL;
+}
 
-    /* If all formals have been bound evaluate */
-    if (f->formals->count == 0) {
+/* Recursion Limits */
 
-        /* Set environment parent to evaluation environment */
-        f->env->par = e;
+/* Calls being evaluated, VM frames or nested tree evaluations, across nested runs */
+long lispy_depth = 0;
 
-        /* Evaluate and return */
-        return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    } else {
-        /* Otherwise return partially evaluated function */
-        return lval_copy(f);
+/* C stack left free for the work done between two checks of it */
+#define LSTACK_RESERVE (256 * 1024)
+
+/* Where the C stack starts and how far it may grow */
+struct { char* base; long size; } lstack;
+
+// note the start of the C stack, "base" being a local of main
+void lstack_init(char* base) {
+    lstack.base = base;
+    lstack.size = 1 << 20;
+#ifndef _WIN32
+    struct rlimit r;
+    if (getrlimit(RLIMIT_STACK, &r) == 0) {
+        lstack.size = (r.rlim_cur == RLIM_INFINITY) ? 64L << 20 : (long)r.rlim_cur;
+    }
+#endif
+}
+
+// error for going one call deeper, or NULL if it may go ahead
+// checked wherever evaluation recurses on the C stack
+lval* ldepth_check(void) {
+    if (lispy_depth >= lispy_max_depth) {
+        return lval_err("Maximum recursion depth of %li exceeded.", lispy_max_depth);
+    }
+    /* A local whose address is taken would make compilers guard the caller's frame */
+#ifdef __GNUC__
+    char* here = __builtin_frame_address(0);
+#else
+    char c;
+    char* here = &c;
+#endif
+    long used = (lstack.base > here) ? lstack.base - here : here - lstack.base;
+    if (lstack.base && used > lstack.size - LSTACK_RESERVE) {
+        return lval_err("Recursion too deep for the C stack after %li nested calls.", lispy_depth);
     }
+    return NULL;
 }
 
+lval* lval_eval_code(lenv* e, lval* v);
+
+// evaluate the elements of "v" as an S-Expression, leaving "v" as it was
+// so lambda bodies and 'if' branches are run straight from the code
 lval* lval_eval_sexpr(lenv* e, lval* v) {
 
-    /* Evaluate Children */
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+    /* Each nested evaluation is a frame on the C stack */
+    lval* x = ldepth_check();
+    if (x) { return x; }
+    lispy_depth++;
+
+    /* Functions whose environments are in use by the current tail call chain */
+    lval* cur = NULL;
+    int held = 0, hold_cap = 0;
+    lval** hold = NULL;
+
+    /* Code selected by 'if', 'eval' or a single expression, owned until done with */
+    lval* owned = NULL;
+
+    /* Expressions in tail position loop here instead of recursing */
+    while (1) {
+
+        /* Empty Expression */
+        if (v->count == 0) {
+            x = lval_sexpr();
+            break;
+        }
+
+        /* Evaluate Children into a list of their own */
+        lval* a = lval_sexpr();
+        lval_resize(a, v->count);
+        for (int i = 0; i < v->count; i++) {
+            a->cell[i] = lval_eval_code(e, v->cell[i]);
+        }
+
+        /* Error Checking */
+        x = NULL;
+        for (int i = 0; i < a->count; i++) {
+            if (lval_type(a->cell[i]) == LVAL_ERR) { x = lval_take(a, i); break; }
+        }
+        if (x) { break; }
+
+        /* Single Expression is evaluated once more */
+        if (a->count == 1) {
+            x = lval_take(a, 0);
+            if (lval_type(x) == LVAL_SEXPR) {
+                if (owned) { lval_del(owned); }
+                owned = v = x;
+                continue;
+            }
+            if (lval_type(x) == LVAL_SYM) {
+                lval* y = lenv_get(e, x);
+                lval_del(x);
+                x = y;
+            }
+            break;
+        }
+
+        /* Ensure First Element is a function after evaluation */
+        lval* f = lval_pop(a, 0);
+        if (lval_type(f) != LVAL_FUN) {
+            x = lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.", ltype_name(lval_type(f)), ltype_name(LVAL_FUN));
+            lval_del(f); lval_del(a);
+            break;
+        }
+
+        /* 'if' and 'eval' continue with the expression they select */
+        if (f->builtin == builtin_if || f->builtin == builtin_eval) {
+            x = (f->builtin == builtin_if) ? builtin_if_branch(a) : builtin_eval_expr(a);
+            lval_del(f);
+            if (lval_type(x) == LVAL_ERR) { break; }
+            if (owned) { lval_del(owned); }
+            owned = v = x;
+            continue;
+        }
+
+        /* If so call function to get result */
+        x = lval_call(e, f, a);
+        if (x) {
+            lval_del(f);
+            break;
+        }
+
+        /* Enter the body of the lambda in its own environment */
+        if (cur && lenv_covers(f->env, e)) {
+            /* Every caller binding is shadowed so its frame can go */
+            f->env->par = e->par;
+            lval_del(cur);
+        } else {
+            f->env->par = e;
+            if (cur) {
+                /* Held frames count towards the depth as well */
+                if (lispy_depth >= lispy_max_depth) {
+                    x = lval_err("Maximum recursion depth of %li exceeded.", lispy_max_depth);
+                    lval_del(f);
+                    break;
+                }
+                lispy_depth++;
+                if (held == hold_cap) {
+                    hold_cap = hold_cap ? hold_cap * 2 : 16;
+                    hold = realloc(hold, sizeof(lval*) * hold_cap);
+                }
+                hold[held++] = cur;
+            }
+        }
+        cur = f;
+        e = f->env;
+
+        /* The body belongs to "f", which is kept until the chain is done */
+        if (owned) { lval_del(owned); owned = NULL; }
+        v = f->body;
+    }
+
+    /* The result holds no references to the environments or code used */
+    if (owned) { lval_del(owned); }
+    if (cur) { lval_del(cur); }
+    lispy_depth -= held + 1;
+    while (held) { lval_del(hold[--held]); }
+    free(hold);
+    return x;
+}
+
+// evaluate "v" without changing it
+lval* lval_eval_code(lenv* e, lval* v) {
+    switch (lval_type(v)) {
+        case LVAL_SYM: return lenv_get(e, v);
+        case LVAL_SEXPR: return lval_eval_sexpr(e, v);
+    }
+    /* All other lval types remain the same */
+    return lval_copy(v);
+}
+
+// reference tree-walking evaluator, consumes "v"
+lval* lval_eval_tree(lenv* e, lval* v) {
+    int t = lval_type(v);
+    if (t != LVAL_SYM && t != LVAL_SEXPR) { return v; }
+    lval* x = lval_eval_code(e, v);
+    lval_del(v);
+    return x;
+}
+
+/* Bytecode */
+
+// instructions understood by the virtual machine, operands follow inline
+enum {
+    OP_CONST,   /* k        push a copy of constant k */
+    OP_LOOKUP,  /* k        push the value bound to symbol constant k */
+    OP_EVAL,    /*          evaluate the value on top of the stack again */
+    OP_CALL,    /* n        call the function below the top n arguments */
+    OP_TAIL,    /* n        as OP_CALL in tail position, reusing the frame when possible */
+    OP_IF,      /* t f l e  inline 'if' with branches at l, falling back to a call */
+    OP_JUMP,    /* l        continue at instruction l */
+    OP_RETURN   /*          return the value on top of the stack to the caller */
+};
+
+// compiled code for an expression or a lambda body
+struct lcode {
+    int refs;
+    int mark;
+
+    /* Instruction stream */
+    int count;
+    int* ops;
+
+    /* Constant pool */
+    int nconsts;
+    lval** consts;
+};
+
+lcode* lcode_new(void) {
+    lcode* c = malloc(sizeof(lcode));
+    c->refs = 1;
+    c->mark = lgc.epoch;
+    c->count = 0;
+    c->ops = NULL;
+    c->nconsts = 0;
+    c->consts = NULL;
+    return c;
+}
+
+lcode* lcode_ref(lcode* c) {
+    c->refs++;
+    return c;
+}
+
+void lcode_del(lcode* c) {
+    if (--c->refs > 0) { return; }
+    for (int i = 0; i < c->nconsts; i++) {
+        lval_del(c->consts[i]);
+    }
+    free(c->consts);
+    free(c->ops);
+    free(c);
+}
+
+// append an instruction word and return its position
+int lcode_emit(lcode* c, int op) {
+    c->count++;
+    c->ops = realloc(c->ops, sizeof(int) * c->count);
+    c->ops[c->count-1] = op;
+    return c->count-1;
+}
+
+// add a copy of "v" to the constant pool and return its index
+int lcode_const(lcode* c, lval* v) {
+    c->nconsts++;
+    c->consts = realloc(c->consts, sizeof(lval*) * c->nconsts);
+    c->consts[c->nconsts-1] = lval_copy(v);
+    return c->nconsts-1;
+}
+
+void lval_compile(lcode* c, lval* v);
+
+// compile a list of expressions evaluated as an S-Expression
+// "tail" is set when its value is returned directly by the code being compiled
+void lval_compile_sexpr(lcode* c, lval** cell, int count, int tail) {
+
+    /* Empty Expression evaluates to itself */
+    if (count == 0) {
+        lval* empty = lval_sexpr();
+        lcode_emit(c, OP_CONST);
+        lcode_emit(c, lcode_const(c, empty));
+        lval_del(empty);
+        return;
+    }
+
+    /* Single Expression is evaluated once more */
+    if (count == 1) {
+        lval_compile(c, cell[0]);
+        lcode_emit(c, OP_EVAL);
+        return;
+    }
+
+    /* Inline 'if' with literal branches, guarded at run time */
+    if (count == 4 && lval_type(cell[0]) == LVAL_SYM && strcmp(cell[0]->sym, "if") == 0
+        && lval_type(cell[2]) == LVAL_QEXPR && lval_type(cell[3]) == LVAL_QEXPR) {
+
+        lval_compile(c, cell[0]);
+        lval_compile(c, cell[1]);
+        lcode_emit(c, OP_IF);
+        lcode_emit(c, lcode_const(c, cell[2]));
+        lcode_emit(c, lcode_const(c, cell[3]));
+        int l_else = lcode_emit(c, 0);
+        int l_end = lcode_emit(c, 0);
+
+        lval_compile_sexpr(c, cell[2]->cell, cell[2]->count, tail);
+        lcode_emit(c, OP_JUMP);
+        int l_jump = lcode_emit(c, 0);
+
+        c->ops[l_else] = c->count;
+        lval_compile_sexpr(c, cell[3]->cell, cell[3]->count, tail);
+        c->ops[l_end] = c->count;
+        c->ops[l_jump] = c->count;
+        return;
+    }
+
+    /* Otherwise evaluate every element and call the first */
+    for (int i = 0; i < count; i++) {
+        lval_compile(c, cell[i]);
+    }
+    lcode_emit(c, tail ? OP_TAIL : OP_CALL);
+    lcode_emit(c, count-1);
+}
+
+// compile a single expression
+void lval_compile(lcode* c, lval* v) {
+    switch (lval_type(v)) {
+        /* The constant keeps the lexical address lval_resolve gave the symbol */
+        case LVAL_SYM:
+            lcode_emit(c, OP_LOOKUP);
+            lcode_emit(c, lcode_const(c, v));
+            break;
+        case LVAL_SEXPR:
+            lval_compile_sexpr(c, v->cell, v->count, 0);
+            break;
+        default:
+            lcode_emit(c, OP_CONST);
+            lcode_emit(c, lcode_const(c, v));
+            break;
+    }
+}
+
+// compile the body of a lambda
+lcode* lval_compile_body(lval* body) {
+    lcode* c = lcode_new();
+    lval_compile_sexpr(c, body->cell, body->count, 1);
+    lcode_emit(c, OP_RETURN);
+    return c;
+}
+
+/* Virtual Machine */
+
+typedef struct {
+    lcode* code;
+    int ip;
+    lenv* env;
+    /* Function owning "env", deleted on return */
+    lval* func;
+} lframe;
+
+typedef struct {
+    int sp;
+    int stack_cap;
+    lval** stack;
+
+    int depth;
+    int frame_cap;
+    lframe* frames;
+} lvm;
+
+void lvm_push(lvm* vm, lval* v) {
+    if (vm->sp == vm->stack_cap) {
+        vm->stack_cap = vm->stack_cap ? vm->stack_cap * 2 : 64;
+        vm->stack = realloc(vm->stack, sizeof(lval*) * vm->stack_cap);
+    }
+    vm->stack[vm->sp++] = v;
+}
+
+lval* lvm_pop(lvm* vm) {
+    return vm->stack[--vm->sp];
+}
+
+void lvm_enter(lvm* vm, lcode* c, lenv* e, lval* func) {
+    if (vm->depth == vm->frame_cap) {
+        vm->frame_cap = vm->frame_cap ? vm->frame_cap * 2 : 16;
+        vm->frames = realloc(vm->frames, sizeof(lframe) * vm->frame_cap);
+    }
+    lframe* fr = &vm->frames[vm->depth++];
+    fr->code = lcode_ref(c);
+    fr->ip = 0;
+    fr->env = e;
+    fr->func = func;
+    lispy_depth++;
+}
+
+void lvm_leave(lvm* vm) {
+    lispy_depth--;
+    lframe* fr = &vm->frames[--vm->depth];
+    lcode_del(fr->code);
+    if (fr->func) { lval_del(fr->func); }
+}
+
+// compiled body of a lambda
+// lambdas made before the engine was chosen are compiled on first use
+lcode* lval_code(lval* f) {
+    if (!f->code) {
+        f->code = lcode_new();
+        lval_compile_sexpr(f->code, f->body->cell, f->body->count, 1);
+        lcode_emit(f->code, OP_RETURN);
     }
+    return f->code;
+}
+
+// call "f" with the evaluated arguments "a", mirroring lval_eval_sexpr
+// a call in tail position replaces the current frame where that is safe
+void lvm_call(lvm* vm, lenv* e, lval* f, lval* a, int tail) {
 
     /* Error Checking */
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    if (lval_type(f) == LVAL_ERR) {
+        lval_del(a);
+        lvm_push(vm, f);
+        return;
+    }
+    for (int i = 0; i < a->count; i++) {
+        if (lval_type(a->cell[i]) == LVAL_ERR) {
+            lval_del(f);
+            lvm_push(vm, lval_take(a, i));
+            return;
+        }
+    }
+
+    /* Ensure First Element is a function */
+    if (lval_type(f) != LVAL_FUN) {
+        lval* err = lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.", ltype_name(lval_type(f)), ltype_name(LVAL_FUN));
+        lval_del(f); lval_del(a);
+        lvm_push(vm, err);
+        return;
     }
 
-    /* Empty Expression */
-    if (v->count == 0) { return v; }
+    lframe* fr = &vm->frames[vm->depth-1];
 
-    /* Single Expression */
-    if (v->count == 1) { return lval_eval(e, lval_take(v, 0)); }
+    /* Evaluate a Q-Expression in a new frame rather than on the C stack */
+    if (f->builtin == builtin_eval && a->count == 1 && lval_type(a->cell[0]) == LVAL_QEXPR) {
+        if (!tail && lispy_depth >= lispy_max_depth) {
+            lval_del(f); lval_del(a);
+            lvm_push(vm, lval_err("Maximum recursion depth of %li exceeded.", lispy_max_depth));
+            return;
+        }
+        lcode* c = lcode_new();
+        lval_compile_sexpr(c, a->cell[0]->cell, a->cell[0]->count, 1);
+        lcode_emit(c, OP_RETURN);
+        lval_del(f); lval_del(a);
+
+        /* In tail position the current frame simply runs the new code */
+        if (tail) {
+            lcode_del(fr->code);
+            fr->code = c;
+            fr->ip = 0;
+        } else {
+            lvm_enter(vm, c, e, NULL);
+            lcode_del(c);
+        }
+        return;
+    }
 
-    /* Ensure First Element is a function after evaluation */
-    lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        lval* err = lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.", ltype_name(f->type), ltype_name(LVAL_FUN));
-        lval_del(f); lval_del(v);
-        return err;
+    /* Builtins, errors and partial application produce a value */
+    lval* x = lval_call(e, f, a);
+    if (x) {
+        lval_del(f);
+        lvm_push(vm, x);
+        return;
     }
 
-    /* If so call function to get result */
-    lval* result = lval_call(e, f, v);
-    lval_del(f);
-    return result;
+    lval_code(f);
+
+    /* A tail call drops the caller when its bindings are all shadowed */
+    if (tail && fr->func && lenv_covers(f->env, e)) {
+        f->env->par = e->par;
+        lvm_leave(vm);
+    } else if (lispy_depth >= lispy_max_depth) {
+        /* Frames live on the heap so only the limit stops them */
+        lval_del(f);
+        lvm_push(vm, lval_err("Maximum recursion depth of %li exceeded.", lispy_max_depth));
+        return;
+    } else {
+        f->env->par = e;
+    }
+    lvm_enter(vm, f->code, f->env, f);
+}
+
+// run compiled code in environment "e" until it returns
+// builtins calling back into Lispy nest runs on the C stack
+lval* lvm_run(lenv* e, lcode* c) {
+    lval* err = ldepth_check();
+    if (err) { return err; }
+
+    lvm vm = { 0, 0, NULL, 0, 0, NULL };
+    lvm_enter(&vm, c, e, NULL);
+
+    while (1) {
+        lframe* fr = &vm.frames[vm.depth-1];
+        int* ops = fr->code->ops;
+        lval** consts = fr->code->consts;
+
+        switch (ops[fr->ip++]) {
+
+            case OP_CONST:
+                lvm_push(&vm, lval_copy(consts[ops[fr->ip++]]));
+                break;
+
+            case OP_LOOKUP:
+                lvm_push(&vm, lenv_get(fr->env, consts[ops[fr->ip++]]));
+                break;
+
+            case OP_EVAL: {
+                lval* v = lvm_pop(&vm);
+                if (lval_type(v) == LVAL_SEXPR || lval_type(v) == LVAL_SYM) {
+                    v = lval_eval(fr->env, v);
+                }
+                lvm_push(&vm, v);
+                break;
+            }
+
+            case OP_CALL:
+            case OP_TAIL: {
+                int tail = ops[fr->ip-1] == OP_TAIL;
+                int n = ops[fr->ip++];
+                lval* a = lval_sexpr();
+                lval_resize(a, n);
+                memcpy(a->cell, &vm.stack[vm.sp-n], sizeof(lval*) * n);
+                for (int i = 0; i < n; i++) { lgc_shade(a->cell[i]); }
+                vm.sp -= n;
+                lvm_call(&vm, fr->env, lvm_pop(&vm), a, tail);
+                break;
+            }
+
+            case OP_IF: {
+                lval* t = consts[ops[fr->ip++]];
+                lval* f = consts[ops[fr->ip++]];
+                int l_else = ops[fr->ip++];
+                int l_end = ops[fr->ip++];
+                lval* cond = lvm_pop(&vm);
+                lval* func = lvm_pop(&vm);
+
+                /* Take the inline branch when 'if' is still the builtin */
+                if (lval_type(func) == LVAL_FUN && func->builtin == builtin_if && lval_is_number(cond)) {
+                    if (!lnum_true(cond)) { fr->ip = l_else; }
+                    lval_del(func); lval_del(cond);
+                    break;
+                }
+
+                /* Otherwise make the call as written */
+                fr->ip = l_end;
+                lval* a = lval_add(lval_sexpr(), cond);
+                lval_add(a, lval_copy(t));
+                lval_add(a, lval_copy(f));
+                lvm_call(&vm, fr->env, func, a, 0);
+                break;
+            }
+
+            case OP_JUMP:
+                fr->ip = ops[fr->ip];
+                break;
+
+            case OP_RETURN:
+                lvm_leave(&vm);
+                if (vm.depth == 0) {
+                    lval* x = lvm_pop(&vm);
+                    free(vm.stack);
+                    free(vm.frames);
+                    return x;
+                }
+                break;
+        }
+    }
+}
+
+// evaluate with the bytecode engine
+lval* lvm_eval(lenv* e, lval* v) {
+    lcode* c = lcode_new();
+    lval_compile(c, v);
+    lcode_emit(c, OP_RETURN);
+    lval_del(v);
+
+    lval* x = lvm_run(e, c);
+    lcode_del(c);
+    return x;
 }
 
+// evaluate with the selected engine
 lval* lval_eval(lenv* e, lval* v) {
-    if (v->type == LVAL_SYM) {
-        lval* x = lenv_get(e, v);
-        lval_del(v);
+    lgc.busy++;
+    lval* x = (lispy_engine == LENGINE_VM) ? lvm_eval(e, v) : lval_eval_tree(e, v);
+    lgc.busy--;
+    return x;
+}
+
+// call "f" with the evaluated arguments "a" from a builtin, as "e" calling it would
+lval* lval_apply(lenv* e, lval* f, lval* a) {
+    lval* x = lval_call(e, f, a);
+    if (x) {
+        lval_del(f);
         return x;
     }
 
-    /* Evaluate Sexpressions */
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-    /* All other lval types remain the same */
-    return v;
+    /* Enter the body of the lambda in its own environment */
+    f->env->par = e;
+    if (lispy_engine == LENGINE_VM) {
+        x = lvm_run(f->env, lval_code(f));
+    } else {
+        x = lval_eval_sexpr(f->env, f->body);
+    }
+    lval_del(f);
+    return x;
+}
+
+/* Garbage Collection */
+
+// keep "v" alive across safe points while it is held outside the environment
+void lgc_root_push(lval* v) {
+    lgc.nroots++;
+    lgc.roots = realloc(lgc.roots, sizeof(lval*) * lgc.nroots);
+    lgc.roots[lgc.nroots-1] = v;
+    lgc_shade(v);
+}
+
+void lgc_root_pop(void) {
+    lgc.nroots--;
+}
+
+// trace every value bound in an environment
+void lgc_scan_env(lenv* e) {
+    if (e->mark == lgc.epoch) { return; }
+    e->mark = lgc.epoch;
+    for (int i = 0; i < e->count; i++) { lgc_shade(e->vals[i]); }
+}
+
+// free an environment only unreachable lvals refer to, they are swept separately
+void lgc_release_env(lenv* e) {
+    if (--e->refs > 0) { return; }
+    for (int i = 0; i < e->count; i++) { LSYM(e->syms[i])->binds--; }
+    lenv_free(e);
+}
+
+// trace what a grey lval refers to
+void lgc_scan(lval* v) {
+    switch (v->type) {
+        case LVAL_FUN:
+            if (v->builtin) { break; }
+            if (v->env) { lgc_scan_env(v->env); }
+            if (v->args) { lgc_shade(v->args); }
+            lgc_shade(v->formals);
+            lgc_shade(v->body);
+            if (v->code && v->code->mark != lgc.epoch) {
+                v->code->mark = lgc.epoch;
+                for (int i = 0; i < v->code->nconsts; i++) { lgc_shade(v->code->consts[i]); }
+            }
+            break;
+        case LVAL_MAP: lmap_shade(v->map); break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            /* Every element of the storage is traced, not just those in the window */
+            if (v->store && v->store->mark != lgc.epoch) {
+                v->store->mark = lgc.epoch;
+                for (int i = 0; i < v->store->count; i++) { lgc_shade(v->store->items[v->store->start + i]); }
+            }
+            break;
+    }
+}
+
+// free an lval nothing can reach, its unreachable contents are swept separately
+void lgc_release(lval* v) {
+    switch (v->type) {
+        case LVAL_FUN:
+            if (v->builtin) { break; }
+            if (v->env) { lgc_release_env(v->env); }
+            if (v->code && --v->code->refs == 0) {
+                free(v->code->consts); free(v->code->ops); free(v->code);
+            }
+            break;
+        case LVAL_ERR: free(v->err); break;
+        case LVAL_STR: free(v->str); break;
+        case LVAL_BIG: free(v->big); break;
+        case LVAL_VEC: lvec_del(v->vec); break;
+        case LVAL_MAT: lmat_del(v->mat); break;
+        case LVAL_MAP: lmap_release(v->map); break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            if (v->store && --v->store->refs == 0) { lcells_del(v->store); }
+            break;
+    }
+    lgc.freed++;
+    lval_free(v);
+}
+
+// microseconds of processor time used
+long lgc_clock(void) {
+    return (long)((double)clock() * 1000000.0 / CLOCKS_PER_SEC);
+}
+
+// do collection work until it finishes or the budget runs out
+void lgc_step(void) {
+    long start = lgc_clock();
+    long work = 0;
+
+    while (lgc.phase != LGC_IDLE) {
+
+        /* Only check the clock every so often */
+        if (lgc.budget && (++work & 255) == 0 && lgc_clock() - start >= lgc.budget) { break; }
+
+        if (lgc.phase == LGC_MARK) {
+            if (lgc.grey_count) {
+                lval* v = lgc.grey[--lgc.grey_count];
+                v->grey = 0;
+                lgc_scan(v);
+                continue;
+            }
+            /* Marking is done, anything unmarked is unreachable */
+            lgc.phase = LGC_SWEEP;
+            lgc.sweep = lgc.nodes;
+            continue;
+        }
+
+        /* Sweep */
+        if (!lgc.sweep) {
+            lgc.phase = LGC_IDLE;
+            lgc.collections++;
+            lgc.threshold = lgc.live * 2;
+            break;
+        }
+        lval* v = lgc.sweep;
+        lgc.sweep = v->gc_next;
+        if (v->mark != lgc.epoch) { lgc_release(v); }
+    }
+
+    long pause = lgc_clock() - start;
+    lgc.pause_total += pause;
+    if (pause > lgc.pause_max) { lgc.pause_max = pause; }
+}
+
+// called between top level expressions when nothing else holds values
+void lgc_safepoint(void) {
+    if (lgc.busy || !lenv_global) { return; }
+
+    /* Start a collection once the live heap has grown enough */
+    if (lgc.phase == LGC_IDLE) {
+        if (lgc.live < LGC_MIN_HEAP || lgc.live < lgc.threshold) { return; }
+        lgc.epoch++;
+        lgc.phase = LGC_MARK;
+        lgc_scan_env(lenv_global);
+        for (int i = 0; i < lgc.nroots; i++) { lgc_shade(lgc.roots[i]); }
+    }
+
+    lgc_step();
+}
+
+// report the state of the collector; any arguments are ignored so
+// it can be called as (gc-stats ()) since (gc-stats) is just the builtin
+lval* builtin_gc_stats(lenv* e, lval* a) {
+    lval_del(a);
+
+    char* names[] = { "heap", "collections", "freed", "pause-total", "pause-max", "budget" };
+    long values[] = { lgc.live, lgc.collections, lgc.freed, lgc.pause_total, lgc.pause_max, lgc.budget };
+
+    lval* x = lval_qexpr();
+    for (int i = 0; i < 6; i++) {
+        lval* pair = lval_qexpr();
+        lval_add(pair, lval_sym(names[i]));
+        lval_add(pair, lval_num(values[i]));
+        lval_add(x, pair);
+    }
+    return x;
 }
 
 
 // exponent
-long expo(long x, long y) {
-    // x ^ y
-    if (y == 1) {
-        return x;
-    } else {
-        return x * expo(x, y - 1);
+int expo(long x, long y, long* r) {
+    // x ^ y by squaring, returning non-zero when it overflows a long
+    // a negative y gives 1 / x ^ -y truncated as '/' does, 0 unless x is 1 or -1
+    if (x == 1 || x == -1) { *r = (x == -1 && (y & 1)) ? -1 : 1; return 0; }
+    if (y < 0 || x == 0) { *r = (y == 0); return 0; }
+
+    /* Every square taken is a factor of the result, so one overflowing means it does */
+    long p = 1;
+    while (1) {
+        if ((y & 1) && lnum_mul(p, x, &p)) { return 1; }
+        y >>= 1;
+        if (!y) { break; }
+        if (lnum_mul(x, x, &x)) { return 1; }
     }
+    *r = p;
+    return 0;
 }
 
 
 lval* lval_read_num(mpc_ast_t* t) {
     errno = 0;
-    long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+    char* end;
+    long x = strtol(t->contents, &end, 10);
+    /* A point or exponent after the digits makes a float */
+    if (*end) { return lval_dbl(strtod(t->contents, NULL)); }
+    /* Literals beyond a long are read as bignums */
+    return errno != ERANGE ? lval_num(x) : lval_big(lbig_read(t->contents));
 }
 
 lval* lval_read_str(mpc_ast_t* t) {
@@ -1153,6 +5235,34 @@ lval* lval_read(mpc_ast_t* t) {
 
 int main(int argc, char** argv)
 {
+    /* Deep recursion is measured from here */
+    char base;
+    lstack_init(&base);
+
+    /* Parse options, every other argument is a file */
+    int files = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) { files++; continue; }
+        if (strcmp(argv[i], "--engine=vm") == 0) {
+            lispy_engine = LENGINE_VM;
+        } else if (strcmp(argv[i], "--engine=tree") == 0) {
+            lispy_engine = LENGINE_TREE;
+        } else if (strncmp(argv[i], "--gc-budget=", 12) == 0) {
+            lgc.budget = strtol(argv[i]+12, NULL, 10);
+        } else if (strcmp(argv[i], "--prelude=lispy") == 0) {
+            lispy_prelude = 1;
+        } else if (strcmp(argv[i], "--prelude=native") == 0) {
+            lispy_prelude = 0;
+        } else if (strncmp(argv[i], "--max-depth=", 12) == 0) {
+            lispy_max_depth = strtol(argv[i]+12, NULL, 10);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            lispy_threads = strtol(argv[i]+10, NULL, 10);
+            if (lispy_threads < 1) { lispy_threads = 1; }
+        } else {
+            fprintf(stderr, "Unknown option '%s'. Expected --engine=vm|tree, --prelude=native|lispy, --gc-budget=<microseconds>, --max-depth=<calls> or --threads=<count>.\n", argv[i]);
+            return 1;
+        }
+    }
 
     /* Parsers */
     Number = mpc_new("number");
@@ -1167,7 +5277,7 @@ int main(int argc, char** argv)
     /* Define them with the following Language */
     mpca_lang(MPCA_LANG_DEFAULT,
               "   \
-        number : /-?[0-9]+/ ;  \
+        number : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ;  \
         symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&^%]+/ ; \
         string : /\"(\\\\.|[^\"])*\"/ ; \
         comment : /;[^\\r\\n]*/ ; \
@@ -1179,10 +5289,11 @@ int main(int argc, char** argv)
               Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
 
     lenv* e = lenv_new();
+    lenv_global = e;
     lenv_add_builtins(e);
 
    /* Interactive Prompt */
-   if (argc == 1) { 
+   if (files == 0) { 
 
         /* Print Version and Exit Information */
         puts("Lispy Version 0.0.0.1.0");
@@ -1208,6 +5319,7 @@ int main(int argc, char** argv)
                 lval_println(x);
                 lval_del(x);
                 mpc_ast_delete(r.output);
+                lgc_safepoint();
             }
             else
             {
@@ -1223,10 +5335,11 @@ int main(int argc, char** argv)
    }
 
     /* Supplied with list of files */
-    if (argc >= 2) {
+    if (files > 0) {
         
         /* Loop over each supplied filename (starting from 1) */
         for (int i = 1; i < argc; i++) {
+            if (strncmp(argv[i], "--", 2) == 0) { continue; }
             
             /* Argument list with a single argument, the filename */
             lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
@@ -1235,11 +5348,12 @@ int main(int argc, char** argv)
             lval* x = builtin_load(e, args);
 
             /* If the result is an error be sure to print it */
-            if (x->type == LVAL_ERR) { lval_println(x); }
+            if (lval_type(x) == LVAL_ERR) { lval_println(x); }
             lval_del(x);
         }
     }
 
+    lenv_global = NULL;
     lenv_del(e);
 
     /* Undefine and Delete our Parsers */